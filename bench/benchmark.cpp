@@ -0,0 +1,232 @@
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "sqlr.h"
+
+// Benchmark of the generation of replicate_sql() on synthetic schemas.
+//
+//   benchmark [-c columns] [-t threads] [tables ...]
+//
+// Every count of tables, 10, 1000 and 50000 by default, is generated once
+// and measured by the throughput of the generation, the peak of the heap
+// and the number of allocations. The output is counted and discarded.
+
+namespace {
+
+// Heap accounting of the replaced global operator new and delete. Each block
+// is prefixed by its size so the delete can account for it.
+std::atomic<std::size_t> allocations{0};
+std::atomic<std::size_t> heap_bytes{0};
+std::atomic<std::size_t> heap_peak{0};
+constexpr std::size_t header = alignof(std::max_align_t);
+
+void *allocate(std::size_t size) {
+  auto block = static_cast<char *>(std::malloc(size + header));
+  if (!block) {
+    throw std::bad_alloc{};
+  }
+  *reinterpret_cast<std::size_t *>(block) = size;
+  ++allocations;
+  auto bytes = heap_bytes += size;
+  for (auto peak = heap_peak.load();
+       bytes > peak && !heap_peak.compare_exchange_weak(peak, bytes);) {
+  }
+  return block + header;
+}
+
+void release(void *pointer) {
+  if (!pointer) {
+    return;
+  }
+  auto block = static_cast<char *>(pointer) - header;
+  heap_bytes -= *reinterpret_cast<std::size_t *>(block);
+  std::free(block);
+}
+
+// Discard the output while counting its bytes.
+class null_buffer : public std::streambuf {
+public:
+  std::size_t count = 0;
+
+protected:
+  int_type overflow(int_type c) override {
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      ++count;
+    }
+    return traits_type::not_eof(c);
+  }
+
+  std::streamsize xsputn(const char *, std::streamsize n) override {
+    count += n;
+    return n;
+  }
+};
+
+// Tables of `columns` columns at the ratios of a typical application: a
+// primary key and a secondary index on every table, a unique key on one in
+// four, a foreign key to the previous table on one in two, a view joining
+// it on one in ten and three seed rows on one in five. One user per hundred
+// tables has permissions on ten of them.
+void synthetic_schema(std::size_t tables, std::size_t columns,
+                      std::string &tables_json, std::string &users_json) {
+  const char *types[] = {"varchar(64)", "int", "datetime", "decimal(12, 2)",
+                         "text"};
+  std::ostringstream out;
+  out << '[';
+  for (std::size_t t = 0; t < tables; ++t) {
+    auto name = "table_" + std::to_string(t);
+    auto parent = t % 2 == 1;
+    out << (t == 0 ? "" : ",") << "\n{\"id\": \"T" << t << "\", \"name\": \""
+        << name << "\", \"engine\": \"InnoDB\", \"columns\": [\n"
+        << "  {\"id\": \"T" << t << "C0\", \"name\": \"id\", "
+        << "\"type\": \"int unsigned\", \"auto\": true}";
+    if (parent) {
+      out << ",\n  {\"id\": \"T" << t << "C1\", \"name\": \"parent\", "
+          << "\"type\": \"int unsigned\", \"null\": true}";
+    }
+    for (std::size_t c = parent ? 2 : 1; c < columns; ++c) {
+      out << ",\n  {\"id\": \"T" << t << 'C' << c << "\", \"name\": \"column_"
+          << c << "\", \"type\": \"" << types[c % 5] << '"'
+          << (c % 5 == 1 ? ", \"default\": \"0\"" : ", \"null\": true")
+          << '}';
+    }
+    out << "],\n\"keys\": [\n"
+        << "  {\"name\": \"PRIMARY\", \"type\": \"primary key\", "
+        << "\"columns\": [\"id\"]}";
+    if (columns > 2) {
+      out << ",\n  {\"name\": \"ix_" << name << "\", \"type\": \"index\", "
+          << "\"columns\": [\"column_2\"]}";
+    }
+    if (t % 4 == 0 && columns > 3) {
+      out << ",\n  {\"name\": \"uq_" << name << "\", \"type\": \"unique\", "
+          << "\"columns\": [\"column_3\"]}";
+    }
+    out << ']';
+    if (parent) {
+      out << ",\n\"foreign-keys\": [{\"name\": \"fk_" << name
+          << "\", \"delete\": \"CASCADE\", \"update\": \"RESTRICT\", "
+          << "\"columns\": [\"parent\"], \"table\": \"table_" << t - 1
+          << "\", \"keys\": [\"id\"]}]";
+    }
+    if (parent && t % 10 == 1) {
+      out << ",\n\"views\": [{\"name\": \"view_" << t
+          << "\", \"columns\": [\"id\"], \"joints\": [{\"table\": \"table_"
+          << t - 1 << "\", \"as\": \"p\", \"type\": \"inner\", "
+          << "\"columns\": [{\"name\": \"id\", \"as\": \"parent_id\"}], "
+          << "\"ons\": [{\"foreign\": \"id\", \"base\": {\"table\": \"" << name
+          << "\", \"column\": \"parent\"}}]}]}]";
+    }
+    if (t % 5 == 0) {
+      out << ",\n\"rows\": [";
+      for (std::size_t r = 1; r <= 3; ++r) {
+        out << (r == 1 ? "" : ", ") << "{\"id\": \"" << r << "\"}";
+      }
+      out << ']';
+    }
+    out << '}';
+  }
+  out << "\n]\n";
+  tables_json = out.str();
+
+  out.str("");
+  out << '[';
+  for (std::size_t u = 0; u < (tables + 99) / 100; ++u) {
+    out << (u == 0 ? "" : ",") << "\n{\"name\": \"user_" << u
+        << "\", \"permissions\": [";
+    for (std::size_t t = u * 100; t < std::min(tables, u * 100 + 10); ++t) {
+      out << (t == u * 100 ? "" : ", ") << "{\"subject\": \"table_" << t
+          << "\", \"operations\": [\"SELECT\", \"INSERT\"]}";
+    }
+    out << "]}";
+  }
+  out << "\n]\n";
+  users_json = out.str();
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+} // namespace
+
+void *operator new(std::size_t size) { return allocate(size); }
+void *operator new[](std::size_t size) { return allocate(size); }
+void operator delete(void *pointer) noexcept { release(pointer); }
+void operator delete[](void *pointer) noexcept { release(pointer); }
+void operator delete(void *pointer, std::size_t) noexcept { release(pointer); }
+void operator delete[](void *pointer, std::size_t) noexcept {
+  release(pointer);
+}
+
+int main(int argc, char **argv) {
+  std::size_t columns = 12;
+  replicate_options options;
+  std::vector<std::size_t> counts;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if ((arg == "-c" || arg == "-t") && i + 1 < argc) {
+      (arg == "-c" ? columns : options.threads) = std::stoul(argv[++i]);
+    } else {
+      counts.push_back(std::stoul(arg));
+    }
+  }
+  if (counts.empty()) {
+    counts = {10, 1000, 50000};
+  }
+
+  std::cout << std::setw(8) << "tables" << std::setw(10) << "compile s"
+            << std::setw(10) << "output s" << std::setw(12) << "tables/s"
+            << std::setw(11) << "output MB" << std::setw(9) << "MB/s"
+            << std::setw(14) << "peak heap MB" << std::setw(13)
+            << "allocations" << '\n';
+  for (auto count : counts) {
+    std::string tables_json, users_json;
+    synthetic_schema(count, columns, tables_json, users_json);
+    jsonio::json tables, users;
+    std::istringstream{tables_json} >> tables;
+    std::istringstream{users_json} >> users;
+    tables_json.clear();
+    tables_json.shrink_to_fit();
+
+    // The peak and the allocations only cover compile_schema() and
+    // replicate_sql(), on top of the parsed input
+    heap_peak = heap_bytes.load();
+    auto baseline = heap_bytes.load();
+    auto allocated = allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    auto compiled = compile_schema(tables);
+    auto compile_seconds = seconds_since(start);
+
+    null_buffer sink;
+    std::ostream out{&sink};
+    start = std::chrono::steady_clock::now();
+    replicate_sql(out, "bench", compiled, users, options);
+    auto output_seconds = seconds_since(start);
+    auto megabytes = sink.count / 1048576.0;
+
+    std::cout << std::fixed << std::setprecision(3) << std::setw(8) << count
+              << std::setw(10) << compile_seconds << std::setw(10)
+              << output_seconds << std::setw(12) << std::setprecision(0)
+              << count / output_seconds << std::setw(11)
+              << std::setprecision(1) << megabytes << std::setw(9)
+              << megabytes / output_seconds << std::setw(14)
+              << (heap_peak - baseline) / 1048576.0 << std::setw(13)
+              << allocations - allocated << '\n';
+  }
+
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  std::cout << "peak resident set: " << usage.ru_maxrss / 1024 << " MB\n";
+}
@@ -0,0 +1,188 @@
+#include <charconv>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "sqlr.h"
+
+// Command line driver of replicate_sql().
+//
+//   sqlr [options] TABLES DATABASE...
+//
+// The definitions are read and compiled once and the script is generated
+// once, then written for every database in turn to the standard output or
+// the output file.
+
+namespace {
+
+const char usage[] = R"(Usage: sqlr [options] TABLES DATABASE...
+Write the script replicating the tables definition file TABLES into every
+DATABASE.
+
+Options:
+  --users FILE     users definition file, no users by default
+  --output FILE    write the script to FILE instead of the standard output
+  --report         add informative logs and timings to the script
+  --dry-run        list the required changes without applying them
+  --threads N      generate the statements of the tables on N threads
+  --stats          print the bytes and time of every phase of the generation
+                   to the standard error
+  --help           print this help
+)";
+
+// Write the output to a file by large chunks, whatever the size of the
+// writes of the generator.
+class file_buffer : public std::streambuf {
+public:
+  explicit file_buffer(std::FILE *file) : file{file}, buffer(1 << 20) {
+    setp(buffer.data(), buffer.data() + buffer.size());
+  }
+
+  ~file_buffer() override { sync(); }
+
+protected:
+  int_type overflow(int_type c) override {
+    if (sync() != 0) {
+      return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  int sync() override {
+    auto size = static_cast<std::size_t>(pptr() - pbase());
+    if (size != 0 && std::fwrite(pbase(), 1, size, file) != size) {
+      return -1;
+    }
+    setp(buffer.data(), buffer.data() + buffer.size());
+    return std::fflush(file) == 0 ? 0 : -1;
+  }
+
+private:
+  std::FILE *file;
+  std::vector<char> buffer;
+};
+
+jsonio::json read_json(const std::string &path) {
+  std::ifstream file{path};
+  jsonio::json value;
+  if (!file || !(file >> value)) {
+    throw std::runtime_error("sqlr: can't read " + path);
+  }
+  return value;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  replicate_options options;
+  replicate_stats stats;
+  bool print_stats = false;
+  std::string users_path, output_path;
+  std::vector<std::string> arguments;
+  try {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      auto value = [&]() -> std::string {
+        if (i + 1 == argc) {
+          throw std::runtime_error("sqlr: missing value of " + arg);
+        }
+        return argv[++i];
+      };
+      if (arg == "--help") {
+        std::cout << usage;
+        return 0;
+      } else if (arg == "--users") {
+        users_path = value();
+      } else if (arg == "--output") {
+        output_path = value();
+      } else if (arg == "--report") {
+        options.report = true;
+      } else if (arg == "--dry-run") {
+        options.dry_run = true;
+      } else if (arg == "--threads") {
+        auto text = value();
+        auto end = text.data() + text.size();
+        auto parsed = std::from_chars(text.data(), end, options.threads);
+        if (parsed.ec != std::errc{} || parsed.ptr != end ||
+            options.threads == 0) {
+          throw std::runtime_error("sqlr: bad value of " + arg);
+        }
+      } else if (arg == "--stats") {
+        print_stats = true;
+      } else if (arg.rfind("--", 0) == 0) {
+        throw std::runtime_error("sqlr: unknown option " + arg);
+      } else {
+        arguments.push_back(arg);
+      }
+    }
+    if (arguments.size() < 2) {
+      std::cerr << usage;
+      return 2;
+    }
+    if (print_stats) {
+      options.stats = &stats;
+    }
+    // Nothing is generated unless every database can be written
+    for (std::size_t i = 1; i < arguments.size(); ++i) {
+      try {
+        check_database_name(arguments[i]);
+      } catch (const std::exception &) {
+        throw std::runtime_error("sqlr: bad DATABASE name " + arguments[i]);
+      }
+    }
+
+    auto tables = compile_schema(read_json(arguments[0]));
+    jsonio::json users;
+    if (users_path.empty()) {
+      std::istringstream{"[]"} >> users;
+    } else {
+      users = read_json(users_path);
+    }
+
+    auto file = output_path.empty() ? stdout
+                                    : std::fopen(output_path.c_str(), "w");
+    if (!file) {
+      throw std::runtime_error("sqlr: can't write " + output_path);
+    }
+    {
+      file_buffer buffer{file};
+      std::ostream out{&buffer};
+      // Several databases share one generation of the script
+      if (arguments.size() == 2) {
+        replicate_sql(out, arguments[1], tables, users, options);
+      } else {
+        auto script = replicate_template(tables, users, options);
+        for (std::size_t i = 1; i < arguments.size(); ++i) {
+          write_sql(out, script, arguments[i]);
+        }
+      }
+      if (print_stats) {
+        for (const auto &phase : stats.phases) {
+          std::cerr << phase.phase << '\t' << phase.bytes << " bytes\t"
+                    << phase.seconds << " s\n";
+        }
+        std::cerr << "Total\t" << stats.bytes << " bytes\t" << stats.seconds
+                  << " s\n";
+      }
+      out.flush();
+      if (!out) {
+        throw std::runtime_error("sqlr: can't write the output");
+      }
+    }
+    if (file != stdout && std::fclose(file) != 0) {
+      throw std::runtime_error("sqlr: can't write " + output_path);
+    }
+  } catch (const std::exception &error) {
+    std::cerr << error.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <cctype>
+
+#include "common.h"
+
+std::size_t algorithm_rank(const std::string &algorithm) {
+  if (algorithm == "instant") {
+    return 0;
+  }
+  if (algorithm == "inplace") {
+    return 1;
+  }
+  if (algorithm == "copy") {
+    return 2;
+  }
+  throw std::runtime_error("Publish MySQL: Bad Algorithm");
+}
+
+std::string schema_warnings(const schema &tables,
+                            const std::string &foreign_key_policy,
+                            const std::string &key_policy) {
+  if (foreign_key_policy != "" && foreign_key_policy != "warn" &&
+      foreign_key_policy != "add") {
+    throw std::runtime_error("Publish MySQL: Bad Foreign Key Indexes");
+  }
+  if (key_policy != "" && key_policy != "warn" && key_policy != "strict") {
+    throw std::runtime_error("Publish MySQL: Bad Redundant Keys");
+  }
+  std::string warnings;
+  if (foreign_key_policy == "warn") {
+    for (const auto &warning : unindexed_foreign_keys(tables)) {
+      warnings += "\n-- " + warning + '\n';
+    }
+  }
+  if (key_policy.empty()) {
+    return warnings;
+  }
+  auto redundant = redundant_keys(tables);
+  if (key_policy == "strict" && !redundant.empty()) {
+    std::string message;
+    for (const auto &problem : redundant) {
+      message += (message.empty() ? "" : "\n") + problem;
+    }
+    throw std::runtime_error(message);
+  }
+  for (const auto &warning : redundant) {
+    warnings += "\n-- " + warning + '\n';
+  }
+  return warnings;
+}
+
+std::vector<row_batch> row_batches(const std::vector<schema_row> &rows,
+                                   std::size_t max_rows,
+                                   std::size_t max_bytes) {
+  if (max_rows == 0 || max_bytes == 0) {
+    throw std::runtime_error("Publish MySQL: Bad Batch Size");
+  }
+  std::vector<row_batch> batches;
+  std::size_t batch_bytes = 0;
+  for (const auto &row : rows) {
+    std::string columns, values;
+    for (std::size_t i = 0; i < row.names.size(); ++i) {
+      if (i != 0) {
+        columns += ", ";
+        values += ", ";
+      }
+      columns += '`' + row.names[i] + '`';
+      values += row.values[i];
+    }
+    if (batches.empty() || batches.back().columns != columns ||
+        batches.back().rows.size() == max_rows ||
+        batch_bytes + values.size() > max_bytes) {
+      batches.push_back({columns, row.names, {}});
+      batch_bytes = 0;
+    }
+    batch_bytes += values.size();
+    batches.back().rows.push_back(values);
+  }
+  return batches;
+}
+
+std::vector<bool> longest_increasing(const std::vector<std::size_t> &sequence) {
+  // Patience sort: tails[k] ends the lowest run of length k + 1 found so far
+  constexpr auto none = static_cast<std::size_t>(-1);
+  std::vector<std::size_t> tails, parents(sequence.size(), none);
+  for (std::size_t i = 0; i < sequence.size(); ++i) {
+    auto tail = std::lower_bound(
+        tails.begin(), tails.end(), sequence[i],
+        [&](std::size_t j, std::size_t value) { return sequence[j] < value; });
+    if (tail != tails.begin()) {
+      parents[i] = *(tail - 1);
+    }
+    if (tail == tails.end()) {
+      tails.push_back(i);
+    } else {
+      *tail = i;
+    }
+  }
+  std::vector<bool> kept(sequence.size(), false);
+  for (auto i = tails.empty() ? none : tails.back(); i != none;
+       i = parents[i]) {
+    kept[i] = true;
+  }
+  return kept;
+}
+
+std::vector<std::string> reconcile_statements(const std::string &db_name,
+                                              const schema_table &table,
+                                              std::size_t max_rows,
+                                              std::size_t max_bytes,
+                                              bool delete_stale) {
+  std::vector<std::string> statements;
+  const auto &primary = table.primary;
+  std::string target = '`' + db_name + "`.`" + table.name + '`';
+  auto is_primary = [&](const std::string &name) {
+    return std::find(primary.begin(), primary.end(), name) != primary.end();
+  };
+  for (const auto &batch : row_batches(table.rows, max_rows, max_bytes)) {
+    if (std::count_if(batch.names.begin(), batch.names.end(), is_primary) !=
+        static_cast<std::ptrdiff_t>(primary.size())) {
+      throw std::runtime_error("Publish MySQL: Row Without Primary Key");
+    }
+    std::string values, same, update;
+    for (const auto &row : batch.rows) {
+      values += (values.empty() ? "ROW(" : ", ROW(") + row + ')';
+    }
+    for (const auto &name : batch.names) {
+      same += (same.empty() ? "`live`.`" : " AND `live`.`") + name +
+              "` <=> `rows`.`" + name + '`';
+      if (!is_primary(name)) {
+        update += (update.empty() ? "`" : ", `") + name + "` = `rows`.`" +
+                  name + '`';
+      }
+    }
+    // Rows already equal to their seed are filtered out, so only the
+    // missing and the changed ones are written
+    statements.push_back(
+        "INSERT " + target + "(" + batch.columns + ") SELECT * FROM (VALUES " +
+        values + ") AS `rows` (" + batch.columns + ") WHERE NOT EXISTS (" +
+        "SELECT 1 FROM " + target + " AS `live` WHERE " + same + ")" +
+        (update.empty() ? "" : " ON DUPLICATE KEY UPDATE " + update) + ";");
+  }
+  if (!delete_stale) {
+    return statements;
+  }
+
+  // Collect the seed keys in a temporary table and delete the rows missing
+  // from it
+  std::string seed = '`' + db_name + "`.`" + bad_prefix + "seed`";
+  std::string columns;
+  for (const auto &name : primary) {
+    columns += (columns.empty() ? "`" : ", `") + name + '`';
+  }
+  statements.push_back("DROP TEMPORARY TABLE IF EXISTS " + seed + ";");
+  statements.push_back("CREATE TEMPORARY TABLE " + seed + " SELECT " +
+                       columns + " FROM " + target + " LIMIT 0;");
+  std::string values;
+  std::size_t count = 0;
+  for (const auto &row : table.rows) {
+    std::string key;
+    for (const auto &name : primary) {
+      auto value = std::find(row.names.begin(), row.names.end(), name);
+      key += (key.empty() ? "" : ", ") +
+             row.values[std::distance(row.names.begin(), value)];
+    }
+    // A key larger than a batch still gets a statement of its own
+    if (!values.empty() &&
+        (count == max_rows || values.size() + key.size() > max_bytes)) {
+      statements.push_back("INSERT " + seed + "(" + columns + ") VALUES" +
+                           values + ";");
+      values.clear();
+      count = 0;
+    }
+    values += (values.empty() ? "(" : ", (") + key + ')';
+    ++count;
+  }
+  if (!values.empty()) {
+    statements.push_back("INSERT " + seed + "(" + columns + ") VALUES" +
+                         values + ";");
+  }
+  statements.push_back("DELETE `live` FROM " + target +
+                       " AS `live` LEFT JOIN " + seed + " AS `seed` USING (" +
+                       columns + ") WHERE `seed`.`" + primary.front() +
+                       "` IS NULL;");
+  statements.push_back("DROP TEMPORARY TABLE " + seed + ";");
+  return statements;
+}
+
+std::string partition_text(const std::string &text) {
+  std::string normalized;
+  for (const char c : text) {
+    if (c != '\'' && c != '"' && c != '`' && c != ' ') {
+      normalized +=
+          static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+  }
+  return normalized;
+}
+
+std::string key_definition(const schema_key &key) {
+  return key.type + " `" + key.name + "` (" + key.quoted_columns + ')' +
+         (key.invisible ? " INVISIBLE" : "");
+}
+
+std::string orphan_select(const std::string &db_name,
+                          const schema_table &table,
+                          const schema_foreign_key &key) {
+  std::string set, match;
+  for (std::size_t i = 0; i < key.columns.size() && i < key.keys.size();
+       ++i) {
+    set += (i == 0 ? "`child`.`" : " AND `child`.`") + key.columns[i] +
+           "` IS NOT NULL";
+    match += (i == 0 ? "`parent`.`" : " AND `parent`.`") + key.keys[i] +
+             "` = `child`.`" + key.columns[i] + '`';
+  }
+  return "SELECT 1 FROM `" + db_name + "`.`" + table.name +
+         "` AS `child` WHERE " + set + " AND NOT EXISTS (SELECT 1 FROM `" +
+         db_name + "`.`" + key.table + "` AS `parent` WHERE " + match +
+         ") LIMIT 1";
+}
+
+std::string view_select(const std::string &db_name, const schema_table &table,
+                        const schema_view &view) {
+  std::string columns;
+  for (const auto &clm : view.columns) {
+    if (!columns.empty()) {
+      columns += ", ";
+    }
+    columns += "`" + table.name + "`.`" + clm + "`";
+  }
+  std::string from =
+      R"( FROM `)" + db_name + R"(`.`)" + table.name + R"(` )";
+  for (const auto &joint : view.joints) {
+    from += joint.type + R"( join `)" + db_name + R"(`.`)" + joint.table +
+            R"(` AS `)" + joint.as + R"(` ON )";
+    std::string ons;
+    for (const auto &on : joint.ons) {
+      if (!ons.empty()) {
+        ons += "AND ";
+      }
+      ons += R"(`)" + db_name + R"(`.`)" + on.base_table + R"(`.`)" +
+             on.base_column + R"(` = `)" + db_name + R"(`.`)" + joint.as +
+             R"(`.`)" + on.foreign + R"(` )";
+    }
+    from += ons;
+    for (const auto &clm : joint.columns) {
+      if (!columns.empty()) {
+        columns += ", ";
+      }
+      columns += R"(`)" + db_name + R"(`.`)" + joint.as + R"(`.`)" + clm.name +
+                 R"(` AS `)" + clm.as + "`";
+    }
+  }
+  return "SELECT\n" + columns + from;
+}
+
+std::string view_statement(const std::string &db_name,
+                           const schema_table &table,
+                           const schema_view &view) {
+  return "CREATE OR REPLACE VIEW `" + db_name + "`.`" + view.name + "` AS " +
+         view_select(db_name, table, view) + ";";
+}
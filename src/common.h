@@ -0,0 +1,81 @@
+#ifndef SQLR_COMMON_H
+#define SQLR_COMMON_H
+
+#include <string>
+#include <vector>
+
+#include <json.hpp>
+
+#include "schema.h"
+
+inline const std::string bad_prefix{"_sql_"};
+inline const std::string drop_prefix{"_drop_"};
+// Prefix of a table swapped out by a shadow copy while rows were written to
+// it, kept for the operator instead of being dropped.
+inline const std::string stale_prefix{"_stale_"};
+// Table keeping the fingerprint of every table applied by the last run.
+inline const std::string fingerprints_table{bad_prefix + "fingerprints"};
+// Table keeping since when every extra index waiting to be dropped is hidden.
+inline const std::string index_drops_table{bad_prefix + "index_drops"};
+
+// SQL comments listing the unindexed foreign keys under the "warn" foreign
+// key policy and the redundant keys under the "warn" key policy. The
+// "strict" key policy throws on redundant keys instead.
+std::string schema_warnings(const schema &tables,
+                            const std::string &foreign_key_policy,
+                            const std::string &key_policy);
+
+// Rank of an online DDL algorithm, from 0 for "instant" to 2 for "copy".
+std::size_t algorithm_rank(const std::string &algorithm);
+
+// Seed rows of one multi-row INSERT: the quoted column list shared by the
+// rows, their names and the comma separated values of each row.
+struct row_batch {
+  std::string columns;
+  std::vector<std::string> names;
+  std::vector<std::string> rows;
+};
+
+// Group consecutive seed rows with the same columns into batches of at most
+// max_rows rows and max_bytes bytes of values.
+std::vector<row_batch> row_batches(const std::vector<schema_row> &rows,
+                                   std::size_t max_rows,
+                                   std::size_t max_bytes);
+
+// Flags of the elements of a longest strictly increasing subsequence, the
+// columns keeping their place while the others move around them.
+std::vector<bool> longest_increasing(const std::vector<std::size_t> &sequence);
+
+// Statements reconciling the rows of the table with its seed rows by the
+// primary key: insert the missing rows, update the changed ones and, with
+// delete_stale, delete the rows that are not seed rows.
+std::vector<std::string> reconcile_statements(const std::string &db_name,
+                                              const schema_table &table,
+                                              std::size_t max_rows,
+                                              std::size_t max_bytes,
+                                              bool delete_stale);
+
+// Partitioning expression or partition values without the quotes, spaces
+// and case the server and the definitions may write differently.
+std::string partition_text(const std::string &text);
+
+// Definition of the key in CREATE TABLE and ALTER TABLE ... ADD.
+std::string key_definition(const schema_key &key);
+
+// SELECT of a row of the table whose foreign key columns are all set but
+// match no row of the referenced table, a row an ADD FOREIGN KEY without
+// foreign_key_checks would keep.
+std::string orphan_select(const std::string &db_name,
+                          const schema_table &table,
+                          const schema_foreign_key &key);
+
+// SELECT statement of a view of the table.
+std::string view_select(const std::string &db_name, const schema_table &table,
+                        const schema_view &view);
+
+// CREATE OR REPLACE VIEW statement of a view of the table.
+std::string view_statement(const std::string &db_name,
+                           const schema_table &table,
+                           const schema_view &view);
+
+#endif // SQLR_COMMON_H
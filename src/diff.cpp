@@ -0,0 +1,1168 @@
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "sqlr.h"
+
+namespace {
+
+struct live_table {
+  const jsonio::json *table;
+  std::vector<const jsonio::json *> columns;
+  std::map<std::string, const jsonio::json *> indexes;
+  // In order, empty for a table without partitions.
+  std::vector<const jsonio::json *> partitions;
+};
+
+bool same(const std::string &a, const std::string &b) {
+  return strcasecmp(a.c_str(), b.c_str()) == 0;
+}
+
+// Whether the live index is visible, as are those of older snapshots.
+bool visible(const jsonio::json &index) {
+  auto flag = index.at("visible");
+  return !flag || flag->get_string() != "NO";
+}
+
+// The default as the COLUMN_DEFAULT of the server shows it: the current time
+// functions as CURRENT_TIMESTAMP with their precision and, for a default of
+// the definition, string literals unquoted and unescaped.
+std::string default_text(const std::string &value, bool literal) {
+  auto size = value.size();
+  if (literal && size >= 2 && (value[0] == '\'' || value[0] == '"') &&
+      value.back() == value[0]) {
+    std::string text;
+    for (std::size_t i = 1; i + 1 < size; ++i) {
+      auto c = value[i];
+      if (c == value[0] && i + 2 < size && value[i + 1] == c) {
+        ++i;
+      } else if (c == '\\' && i + 2 < size) {
+        switch (c = value[++i]) {
+        case '0':
+          c = '\0';
+          break;
+        case 'b':
+          c = '\b';
+          break;
+        case 'n':
+          c = '\n';
+          break;
+        case 'r':
+          c = '\r';
+          break;
+        case 't':
+          c = '\t';
+          break;
+        case 'Z':
+          c = '\x1a';
+          break;
+        }
+      }
+      text += c;
+    }
+    return text;
+  }
+  std::string name;
+  for (auto c : value) {
+    if (!isspace(static_cast<unsigned char>(c))) {
+      name += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+  }
+  for (std::string function :
+       {"current_timestamp", "localtimestamp", "localtime", "now"}) {
+    if (name.compare(0, function.size(), function) != 0) {
+      continue;
+    }
+    auto rest = name.substr(function.size());
+    if (rest.empty() || rest == "()" || rest == "(0)") {
+      return "CURRENT_TIMESTAMP";
+    }
+    if (rest.size() == 3 && rest[0] == '(' &&
+        isdigit(static_cast<unsigned char>(rest[1])) && rest[2] == ')') {
+      return "CURRENT_TIMESTAMP" + rest;
+    }
+  }
+  return value;
+}
+
+bool same_default(const jsonio::json *live,
+                  const std::optional<std::string> &target) {
+  if (!target) {
+    return !live;
+  }
+  if (!live) {
+    return same(*target, "null");
+  }
+  auto live_text = default_text(live->get_string(), false);
+  auto target_text = default_text(*target, true);
+  if (live_text == target_text ||
+      (target_text == *target && same(live_text, target_text))) {
+    return true;
+  }
+  char *live_end, *target_end;
+  auto live_value = strtod(live_text.c_str(), &live_end);
+  auto target_value = strtod(target_text.c_str(), &target_end);
+  return !live_text.empty() && !*live_end && !target_text.empty() &&
+         !*target_end && live_value == target_value;
+}
+
+std::string column_definition(const schema_column &column) {
+  return column.definition + " COMMENT '" + column.id + "'";
+}
+
+std::string join(const std::vector<std::string> &items,
+                 const std::string &separator) {
+  std::string joined;
+  for (const auto &item : items) {
+    if (!joined.empty()) {
+      joined += separator;
+    }
+    joined += item;
+  }
+  return joined;
+}
+
+// Intended change of a table in the migration plan, with the cheapest online
+// DDL algorithm able to apply it, empty outside of an ALTER TABLE.
+struct plan_operation {
+  std::string operation;
+  std::string name;
+  std::string from;
+  std::string algorithm;
+  std::size_t rows = 0;
+};
+
+struct plan_table {
+  std::string name;
+  // Live name of a renamed or dropped table.
+  std::string from;
+  // Live table, null for a new table.
+  const jsonio::json *live = nullptr;
+  // Online DDL policy of the table, empty to follow the one of the run.
+  std::string policy;
+  std::vector<plan_operation> operations;
+};
+
+struct migration_plan {
+  bool new_database = false;
+  std::vector<plan_table> tables;
+};
+
+// Partition maintenance statements bringing the live partitions, in order,
+// in line with the partitioning of the table, as replicate_sql() does it on
+// the server, with their operations for the plan.
+std::vector<std::string>
+partition_changes(const schema_table &table,
+                  const std::vector<const jsonio::json *> &live,
+                  std::vector<plan_operation> &operations) {
+  const auto &partitioning = *table.partitioning;
+  std::vector<std::string> changes;
+  if (partitioning.type == "NONE") {
+    if (!live.empty()) {
+      changes.push_back("REMOVE PARTITIONING");
+      operations.push_back({"remove-partitioning", "", "", "copy"});
+    }
+    return changes;
+  }
+  // A partition renamed by the definition, with the bound or values of a
+  // defined one, is kept to be reorganized, which keeps its rows
+  std::vector<const jsonio::json *> kept;
+  std::vector<std::string> drops;
+  for (auto partition : live) {
+    const auto &name = (*partition)["name"].get_string();
+    auto values = partition_text((*partition)["description"].get_string());
+    if (partitioning.partitions.empty() ||
+        std::any_of(partitioning.partitions.begin(),
+                    partitioning.partitions.end(), [&](const auto &part) {
+                      return same(part.name, name) ||
+                             partition_text(part.values) == values;
+                    })) {
+      kept.push_back(partition);
+    } else {
+      drops.push_back(name);
+    }
+  }
+  auto method = live.empty() ? "" : (*live.front())["method"].get_string();
+  if (method != partitioning.type || kept.empty() ||
+      partition_text((*live.front())["expression"].get_string()) !=
+          partition_text(partitioning.expression)) {
+    changes.push_back(partitioning.definition);
+    operations.push_back(
+        {"partition-table", partitioning.type, method, "copy"});
+    return changes;
+  }
+  if (partitioning.partitions.empty()) {
+    // Hash partitions are redistributed
+    if (live.size() < partitioning.count) {
+      changes.push_back("ADD PARTITION PARTITIONS " +
+                        std::to_string(partitioning.count - live.size()));
+      operations.push_back({"add-partition", "", "", "copy"});
+    } else if (live.size() > partitioning.count) {
+      changes.push_back("COALESCE PARTITION " +
+                        std::to_string(live.size() - partitioning.count));
+      operations.push_back({"coalesce-partition", "", "", "copy"});
+    }
+    return changes;
+  }
+  if (!drops.empty()) {
+    changes.push_back("DROP PARTITION `" + join(drops, "`, `") + '`');
+    for (const auto &name : drops) {
+      operations.push_back({"drop-partition", name, "", "inplace"});
+    }
+  }
+  // The partitions past the ones matching the definition are added, or
+  // reorganized into the defined ones
+  std::size_t matched = 0;
+  const auto &parts = partitioning.partitions;
+  while (matched < kept.size() && matched < parts.size() &&
+         same((*kept[matched])["name"].get_string(), parts[matched].name) &&
+         partition_text((*kept[matched])["description"].get_string()) ==
+             partition_text(parts[matched].values)) {
+    ++matched;
+  }
+  if (matched == parts.size()) {
+    return changes;
+  }
+  std::vector<std::string> definitions;
+  for (auto part = parts.begin() + matched; part != parts.end(); ++part) {
+    definitions.push_back(part->definition);
+  }
+  if (matched == kept.size()) {
+    changes.push_back("ADD PARTITION (" + join(definitions, ", ") + ')');
+    for (auto part = parts.begin() + matched; part != parts.end(); ++part) {
+      operations.push_back({"add-partition", part->name, "", "inplace"});
+    }
+    return changes;
+  }
+  std::vector<std::string> reorganized;
+  for (auto partition = kept.begin() + matched; partition != kept.end();
+       ++partition) {
+    reorganized.push_back((**partition)["name"].get_string());
+    operations.push_back(
+        {"reorganize-partition", reorganized.back(), "", "copy"});
+  }
+  changes.push_back("REORGANIZE PARTITION `" + join(reorganized, "`, `") +
+                    "` INTO (" + join(definitions, ", ") + ')');
+  return changes;
+}
+
+// SELECT of a view reduced to its tokens, so the text view_select() writes
+// and the VIEW_DEFINITION the server keeps for it compare equal: keywords in
+// lower case, without parentheses, the database qualifier, AS and the
+// optional join words, nor an alias repeating the name before it. A view
+// the server rewrote otherwise, like a right join, compares different and is
+// replaced.
+std::string view_text(const std::string &db_name, const std::string &text) {
+  std::vector<std::string> tokens;
+  for (std::size_t i = 0; i < text.size();) {
+    auto c = static_cast<unsigned char>(text[i]);
+    std::string token;
+    if (c == '`') {
+      auto end = text.find('`', i + 1);
+      end = end == std::string::npos ? text.size() : end + 1;
+      token = text.substr(i, end - i);
+      i = end;
+    } else if (isalnum(c) || c == '_') {
+      for (; i < text.size() &&
+             (isalnum(static_cast<unsigned char>(text[i])) ||
+              text[i] == '_');
+           ++i) {
+        token += static_cast<char>(
+            tolower(static_cast<unsigned char>(text[i])));
+      }
+    } else {
+      token = text[i++];
+    }
+    if (token == "." && !tokens.empty() &&
+        tokens.back() == '`' + db_name + '`') {
+      tokens.pop_back();
+    } else if (!token.empty() && !isspace(c) && token != "(" &&
+               token != ")" && token != "as" && token != "inner" &&
+               token != "outer" &&
+               (tokens.empty() || token[0] != '`' || token != tokens.back())) {
+      tokens.push_back(token);
+    }
+  }
+  return join(tokens, " ");
+}
+
+std::string json_string(const std::string &text) {
+  std::string quoted = "\"";
+  for (auto c : text) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+      quoted += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[7];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      quoted += escaped;
+    } else {
+      quoted += c;
+    }
+  }
+  return quoted + '"';
+}
+
+// Number exported as a string by the snapshot, null when it is missing.
+std::string json_count(const jsonio::json *live, const char *field) {
+  auto value = live ? live->at(field) : nullptr;
+  return value ? std::to_string(std::stoull(value->get_string())) : "null";
+}
+
+void diff(std::ostream &out, const std::string &db_name, const schema &tables,
+          const jsonio::json &users, const jsonio::json &live,
+          const replicate_options &options, migration_plan *plan);
+
+} // namespace
+
+std::string snapshot_sql(const std::string &db_name) {
+  return R"(
+set session group_concat_max_len = 1048576;
+select json_object(
+    'schemata', (select ifnull(json_arrayagg(`SCHEMA_NAME`), json_array())
+        from `INFORMATION_SCHEMA`.`SCHEMATA`
+        where `SCHEMA_NAME` = ')" +
+         db_name + R"('),
+    'tables', (select ifnull(json_arrayagg(json_object(
+            'name', `TABLE_NAME`,
+            'type', `TABLE_TYPE`,
+            'engine', ifnull(`ENGINE`, ''),
+            'comment', `TABLE_COMMENT`,
+            'rows', cast(ifnull(`TABLE_ROWS`, 0) as char),
+            'data-length', cast(ifnull(`DATA_LENGTH`, 0) as char))),
+            json_array())
+        from `INFORMATION_SCHEMA`.`TABLES`
+        where `TABLE_SCHEMA` = ')" +
+         db_name + R"('),
+    'columns', (select ifnull(json_arrayagg(json_merge_patch(json_object(
+            'table', `TABLE_NAME`,
+            'name', `COLUMN_NAME`,
+            'position', cast(`ORDINAL_POSITION` as char),
+            'type', `COLUMN_TYPE`,
+            'null', `IS_NULLABLE`,
+            'extra', `EXTRA`,
+            'comment', `COLUMN_COMMENT`),
+            json_object('default', `COLUMN_DEFAULT`))), json_array())
+        from `INFORMATION_SCHEMA`.`COLUMNS`
+        where `TABLE_SCHEMA` = ')" +
+         db_name + R"('),
+    'indexes', (select ifnull(json_arrayagg(json_object(
+            'table', `TABLE_NAME`,
+            'name', `INDEX_NAME`,
+            'unique', if(`NON_UNIQUE` = 0, 'YES', 'NO'),
+            'visible', `IS_VISIBLE`,
+            'columns', `columns`)), json_array())
+        from (select `TABLE_NAME`, `INDEX_NAME`, `NON_UNIQUE`, `IS_VISIBLE`,
+            cast(concat('[', group_concat(json_quote(`COLUMN_NAME`)
+                ORDER BY `SEQ_IN_INDEX` SEPARATOR ', '), ']') as json)
+                as `columns`
+        from `INFORMATION_SCHEMA`.`STATISTICS`
+        where `TABLE_SCHEMA` = ')" +
+         db_name + R"('
+        group by `TABLE_NAME`, `INDEX_NAME`, `NON_UNIQUE`, `IS_VISIBLE`)
+            as `i`),
+    'partitions', (select ifnull(json_arrayagg(json_object(
+            'table', `TABLE_NAME`,
+            'name', `PARTITION_NAME`,
+            'position', cast(`PARTITION_ORDINAL_POSITION` as char),
+            'method', `PARTITION_METHOD`,
+            'expression', ifnull(`PARTITION_EXPRESSION`, ''),
+            'description', ifnull(`PARTITION_DESCRIPTION`, ''))), json_array())
+        from (select distinct `TABLE_NAME`, `PARTITION_NAME`,
+            `PARTITION_ORDINAL_POSITION`, `PARTITION_METHOD`,
+            `PARTITION_EXPRESSION`, `PARTITION_DESCRIPTION`
+        from `INFORMATION_SCHEMA`.`PARTITIONS`
+        where `TABLE_SCHEMA` = ')" +
+         db_name + R"(' and `PARTITION_NAME` is not null) as `p`),
+    'views', (select ifnull(json_arrayagg(json_object(
+            'name', `TABLE_NAME`,
+            'definition', `VIEW_DEFINITION`)), json_array())
+        from `INFORMATION_SCHEMA`.`VIEWS`
+        where `TABLE_SCHEMA` = ')" +
+         db_name + R"('),
+    'foreign-keys', (select ifnull(json_arrayagg(json_object(
+            'name', `CONSTRAINT_NAME`,
+            'table', `TABLE_NAME`,
+            'columns', `columns`,
+            'referenced-table', `REFERENCED_TABLE_NAME`,
+            'referenced-columns', `referenced_columns`,
+            'update', `UPDATE_RULE`,
+            'delete', `DELETE_RULE`)), json_array())
+        from `INFORMATION_SCHEMA`.`REFERENTIAL_CONSTRAINTS`
+        join (select `CONSTRAINT_SCHEMA`, `CONSTRAINT_NAME`, `TABLE_NAME`,
+            `REFERENCED_TABLE_NAME`,
+            cast(concat('[', group_concat(json_quote(`COLUMN_NAME`)
+                ORDER BY `ORDINAL_POSITION` SEPARATOR ', '), ']') as json)
+                as `columns`,
+            cast(concat('[', group_concat(json_quote(`REFERENCED_COLUMN_NAME`)
+                ORDER BY `POSITION_IN_UNIQUE_CONSTRAINT` SEPARATOR ', '), ']')
+                as json) as `referenced_columns`
+        from `INFORMATION_SCHEMA`.`KEY_COLUMN_USAGE`
+        where
+            `REFERENCED_TABLE_NAME` is not null and
+            `CONSTRAINT_SCHEMA` = ')" +
+         db_name + R"('
+        group by `CONSTRAINT_SCHEMA`, `CONSTRAINT_NAME`, `TABLE_NAME`,
+            `REFERENCED_TABLE_NAME`) as `fk`
+        using (
+            `CONSTRAINT_SCHEMA`,
+            `CONSTRAINT_NAME`,
+            `TABLE_NAME`,
+            `REFERENCED_TABLE_NAME`)),
+    'users', (select ifnull(json_arrayagg(`User`), json_array())
+        from `mysql`.`user`),
+    'grants', (select ifnull(json_arrayagg(json_object(
+            'user', `User`,
+            'table', `Table_name`,
+            'privileges', cast(`Table_priv` as char))), json_array())
+        from `mysql`.`tables_priv`
+        where `Db` = ')" +
+         db_name + R"(')
+) as '';
+)";
+}
+
+std::string diff_sql(const std::string &db_name, const jsonio::json &tables,
+                     const jsonio::json &users, const jsonio::json &live,
+                     const replicate_options &options) {
+  std::ostringstream out;
+  diff_sql(out, db_name, compile_schema(tables), users, live, options);
+  return out.str();
+}
+
+void diff_sql(std::ostream &out, const std::string &db_name,
+              const jsonio::json &tables, const jsonio::json &users,
+              const jsonio::json &live, const replicate_options &options) {
+  diff_sql(out, db_name, compile_schema(tables), users, live, options);
+}
+
+void diff_sql(std::ostream &out, const std::string &db_name,
+              const schema &tables, const jsonio::json &users,
+              const jsonio::json &live, const replicate_options &options) {
+  diff(out, db_name, tables, users, live, options, nullptr);
+}
+
+void plan_json(std::ostream &out, const std::string &db_name,
+               const jsonio::json &tables, const jsonio::json &users,
+               const jsonio::json &live, const replicate_options &options) {
+  plan_json(out, db_name, compile_schema(tables), users, live, options);
+}
+
+std::string plan_json(const std::string &db_name, const jsonio::json &tables,
+                      const jsonio::json &users, const jsonio::json &live,
+                      const replicate_options &options) {
+  std::ostringstream out;
+  plan_json(out, db_name, compile_schema(tables), users, live, options);
+  return out.str();
+}
+
+void plan_json(std::ostream &out, const std::string &db_name,
+               const schema &tables, const jsonio::json &users,
+               const jsonio::json &live, const replicate_options &options) {
+  // The statements themselves are discarded
+  migration_plan plan;
+  std::ostream discard(nullptr);
+  diff(discard, db_name, tables, users, live, options, &plan);
+
+  out << "{\n  \"database\": " << json_string(db_name)
+      << ",\n  \"new-database\": " << (plan.new_database ? "true" : "false")
+      << ",\n  \"tables\": [";
+  std::string separator = "\n";
+  for (const auto &table : plan.tables) {
+    if (table.operations.empty()) {
+      continue;
+    }
+    std::string algorithm;
+    for (const auto &operation : table.operations) {
+      if (!operation.algorithm.empty() &&
+          (algorithm.empty() || algorithm_rank(operation.algorithm) >
+                                    algorithm_rank(algorithm))) {
+        algorithm = operation.algorithm;
+      }
+    }
+    out << separator << "    {\n      \"name\": " << json_string(table.name);
+    if (!table.from.empty()) {
+      out << ",\n      \"from\": " << json_string(table.from);
+    }
+    out << ",\n      \"rows\": " << json_count(table.live, "rows")
+        << ",\n      \"data-length\": "
+        << json_count(table.live, "data-length") << ",\n      \"algorithm\": "
+        << (algorithm.empty() ? "null" : json_string(algorithm));
+    if (!table.policy.empty()) {
+      out << ",\n      \"policy\": " << json_string(table.policy);
+    }
+    out << ",\n      \"operations\": [";
+    std::string operation_separator = "\n";
+    for (const auto &operation : table.operations) {
+      out << operation_separator << "        {\"operation\": "
+          << json_string(operation.operation);
+      if (!operation.name.empty()) {
+        out << ", \"name\": " << json_string(operation.name);
+      }
+      if (!operation.from.empty()) {
+        out << ", \"from\": " << json_string(operation.from);
+      }
+      if (operation.rows != 0) {
+        out << ", \"rows\": " << operation.rows;
+      }
+      out << ", \"algorithm\": "
+          << (operation.algorithm.empty() ? "null"
+                                          : json_string(operation.algorithm))
+          << "}";
+      operation_separator = ",\n";
+    }
+    out << "\n      ]\n    }";
+    separator = ",\n";
+  }
+  out << (separator == "\n" ? "]\n}\n" : "\n  ]\n}\n");
+}
+
+namespace {
+
+void diff(std::ostream &out, const std::string &db_name, const schema &tables,
+          const jsonio::json &users, const jsonio::json &live,
+          const replicate_options &options, migration_plan *plan) {
+  if (!options.algorithm.empty()) {
+    algorithm_rank(options.algorithm);
+  }
+  auto warnings = schema_warnings(tables, options.foreign_key_indexes,
+                                  options.redundant_keys);
+  if (options.foreign_key_indexes == "add") {
+    auto indexed = tables;
+    index_foreign_keys(indexed);
+    auto indexed_options = options;
+    indexed_options.foreign_key_indexes.clear();
+    diff(out, db_name, indexed, users, live, indexed_options, plan);
+    return;
+  }
+
+  // Index the live schema
+  std::map<std::string, live_table> live_tables;
+  std::map<std::string, std::string> live_ids;
+  std::set<std::string> live_views;
+  for (const auto &table : live["tables"].get_array()) {
+    if (table["type"].get_string() == "VIEW") {
+      live_views.insert(table["name"].get_string());
+      continue;
+    }
+    live_tables[table["name"].get_string()].table = &table;
+    if (!table["comment"].get_string().empty() &&
+        !live_ids
+             .emplace(table["comment"].get_string(), table["name"].get_string())
+             .second) {
+      throw std::runtime_error("Publish MySQL: Repeated Live Table Id");
+    }
+  }
+  for (const auto &column : live["columns"].get_array()) {
+    if (auto table = live_tables.find(column["table"].get_string());
+        table != live_tables.end()) {
+      table->second.columns.push_back(&column);
+    }
+  }
+  for (auto &[name, table] : live_tables) {
+    std::sort(table.columns.begin(), table.columns.end(),
+              [](auto a, auto b) {
+                return std::stoul((*a)["position"].get_string()) <
+                       std::stoul((*b)["position"].get_string());
+              });
+  }
+  for (const auto &index : live["indexes"].get_array()) {
+    if (auto table = live_tables.find(index["table"].get_string());
+        table != live_tables.end()) {
+      table->second.indexes[index["name"].get_string()] = &index;
+    }
+  }
+  // Snapshots exported before the partitions leave them alone
+  auto live_partitions = live.at("partitions");
+  for (std::size_t i = 0;
+       live_partitions && i < live_partitions->get_array().size(); ++i) {
+    const auto &partition = live_partitions->get_array()[i];
+    if (auto table = live_tables.find(partition["table"].get_string());
+        table != live_tables.end()) {
+      table->second.partitions.push_back(&partition);
+    }
+  }
+  for (auto &[name, table] : live_tables) {
+    std::sort(table.partitions.begin(), table.partitions.end(),
+              [](auto a, auto b) {
+                return std::stoul((*a)["position"].get_string()) <
+                       std::stoul((*b)["position"].get_string());
+              });
+  }
+  std::map<std::string, const jsonio::json *> live_foreign_keys;
+  for (const auto &foreign_key : live["foreign-keys"].get_array()) {
+    live_foreign_keys[foreign_key["name"].get_string()] = &foreign_key;
+  }
+
+  // Match the definitions with the live tables and columns by id
+  std::map<std::string, const schema_table *> matches;
+  std::map<std::string, std::string> table_names;
+  std::map<std::string, std::map<std::string, std::string>> column_names;
+  for (const auto &table : tables.tables) {
+    auto old_name = live_ids.find(table.id);
+    if (old_name == live_ids.end()) {
+      continue;
+    }
+    auto &live_table = live_tables[old_name->second];
+    matches[table.name] = &table;
+    table_names[old_name->second] = table.name;
+    for (const auto &column : table.columns) {
+      for (auto live_column : live_table.columns) {
+        if ((*live_column)["comment"].get_string() ==
+            column.id) {
+          column_names[old_name->second][(*live_column)["name"].get_string()] =
+              column.name;
+        }
+      }
+    }
+  }
+  auto new_columns = [&](const std::string &old_table,
+                         const jsonio::json &columns) {
+    std::vector<std::string> names;
+    for (const auto &clm : columns.get_array()) {
+      auto column = column_names[old_table].find(clm.get_string());
+      names.push_back(column == column_names[old_table].end()
+                          ? ""
+                          : '`' + column->second + '`');
+    }
+    return join(names, ", ");
+  };
+
+  // Planned operations of the definition tables, in their order
+  std::map<std::string, std::size_t> planned;
+  if (plan) {
+    for (const auto &table : tables.tables) {
+      plan_table entry{table.name, "", nullptr,
+                       table.algorithm.empty() ? options.algorithm
+                                               : table.algorithm,
+                       {}};
+      if (auto old_name = live_ids.find(table.id); old_name != live_ids.end()) {
+        entry.live = live_tables[old_name->second].table;
+        if (old_name->second != table.name) {
+          entry.from = old_name->second;
+        }
+      }
+      planned[table.name] = plan->tables.size();
+      plan->tables.push_back(entry);
+    }
+  }
+  // Most expensive algorithm of the operations recorded since the last
+  // ALTER TABLE
+  std::size_t alter_cost = 0;
+  auto record = [&](const std::string &table, plan_operation operation) {
+    if (!operation.algorithm.empty()) {
+      alter_cost = std::max(alter_cost, algorithm_rank(operation.algorithm));
+    }
+    if (plan) {
+      plan->tables[planned[table]].operations.push_back(operation);
+    }
+  };
+
+  // The cheapest algorithm the operations of an ALTER TABLE allow, capped by
+  // the policy, as replicate_sql() appends it. Empty without a policy.
+  auto algorithm_clause = [&](const schema_table &table, std::size_t cost) {
+    const auto &policy =
+        table.algorithm.empty() ? options.algorithm : table.algorithm;
+    if (policy.empty()) {
+      return std::string{};
+    }
+    const char *clauses[] = {"ALGORITHM=INSTANT",
+                             "ALGORITHM=INPLACE, LOCK=NONE", "ALGORITHM=COPY"};
+    return std::string{clauses[std::min(cost, algorithm_rank(policy))]};
+  };
+
+  std::string note = options.report ? "\n-- " : "";
+  std::string sql = warnings;
+
+  // Hand the pending statements to the sink
+  auto flush = [&]() {
+    out << sql;
+    sql.clear();
+  };
+
+  // Create database
+  if (live["schemata"].get_array().empty()) {
+    sql += "\nCREATE DATABASE `" + db_name + "`;\n";
+    if (plan) {
+      plan->new_database = true;
+    }
+  } else if (options.report) {
+    sql += note + "Database \"" + db_name + "\" exists.\n";
+  }
+
+  // Remove extra views
+  std::set<std::string> all_views;
+  for (const auto &table : tables.tables) {
+    for (const auto &view : table.views) {
+      all_views.insert(view.name);
+    }
+  }
+  std::vector<std::string> drop_views;
+  for (const auto &view : live_views) {
+    if (all_views.find(view) == all_views.end()) {
+      drop_views.push_back('`' + db_name + "`.`" + view + '`');
+    }
+  }
+  if (!drop_views.empty()) {
+    sql += "\nDROP VIEW " + join(drop_views, ", ") + ";\n";
+  }
+
+  // Drop wrong and extra foreign keys
+  std::set<std::string> kept_foreign_keys;
+  std::map<std::string, std::vector<std::string>> drop_foreign_keys;
+  for (const auto &[name, foreign_key] : live_foreign_keys) {
+    const auto &old_table = (*foreign_key)["table"].get_string();
+    auto table_name = table_names.find(old_table);
+    if (table_name == table_names.end()) {
+      continue;
+    }
+    const schema_foreign_key *key = nullptr;
+    for (const auto &candidate : matches[table_name->second]->foreign_keys) {
+      if (candidate.name == name) {
+        key = &candidate;
+      }
+    }
+    const auto &old_referenced_table =
+        (*foreign_key)["referenced-table"].get_string();
+    auto referenced_table = table_names.find(old_referenced_table);
+    if (key && referenced_table != table_names.end() &&
+        referenced_table->second == key->table &&
+        new_columns(old_table, (*foreign_key)["columns"]) ==
+            key->quoted_columns &&
+        new_columns(old_referenced_table,
+                    (*foreign_key)["referenced-columns"]) == key->quoted_keys &&
+        same((*foreign_key)["update"].get_string(), key->on_update) &&
+        same((*foreign_key)["delete"].get_string(), key->on_delete)) {
+      kept_foreign_keys.insert(name);
+    } else {
+      drop_foreign_keys[old_table].push_back("DROP FOREIGN KEY `" + name +
+                                             '`');
+      record(table_name->second, {"drop-foreign-key", name, "", "inplace"});
+    }
+  }
+  for (auto &[old_table, drops] : drop_foreign_keys) {
+    auto clause = algorithm_clause(*matches[table_names[old_table]], 1);
+    if (!clause.empty()) {
+      drops.push_back(clause);
+    }
+    sql += "\nALTER TABLE `" + db_name + "`.`" + old_table + "` " +
+           join(drops, ", ") + ";\n";
+  }
+
+  // Remove extra tables
+  std::vector<std::string> drop_tables;
+  for (const auto &[name, table] : live_tables) {
+    if (table_names.find(name) == table_names.end() &&
+        name != fingerprints_table && name != index_drops_table &&
+        name.rfind(bad_prefix + stale_prefix, 0) != 0) {
+      drop_tables.push_back('`' + db_name + "`.`" + name + '`');
+      if (plan) {
+        plan->tables.push_back(
+            {name, "", table.table, "", {{"drop-table", name, "", ""}}});
+      }
+    }
+  }
+  if (!drop_tables.empty()) {
+    sql += "\nDROP TABLE " + join(drop_tables, ", ") + ";\n";
+  }
+
+  // Apply table names
+  std::set<std::string> occupied{live_views.begin(), live_views.end()};
+  std::map<std::string, std::string> pending;
+  for (const auto &[old_name, name] : table_names) {
+    occupied.insert(old_name);
+    if (old_name != name) {
+      pending[old_name] = name;
+      record(name, {"rename-table", name, old_name, ""});
+    }
+  }
+  std::vector<std::string> renames;
+  auto rename = [&](const std::string &from, const std::string &to) {
+    renames.push_back('`' + db_name + "`.`" + from + "` to `" + db_name +
+                      "`.`" + to + '`');
+    occupied.erase(from);
+    occupied.insert(to);
+  };
+  while (!pending.empty()) {
+    auto next = std::find_if(pending.begin(), pending.end(), [&](auto &p) {
+      return occupied.find(p.second) == occupied.end();
+    });
+    if (next == pending.end()) {
+      // Break a cycle of renames through a prefixed name
+      next = pending.begin();
+      rename(next->first, bad_prefix + next->second);
+      pending[bad_prefix + next->second] = next->second;
+    } else {
+      rename(next->first, next->second);
+    }
+    pending.erase(next);
+  }
+  if (!renames.empty()) {
+    sql += "\nRENAME TABLE " + join(renames, ", ") + ";\n";
+  }
+
+  // Create tables
+  for (const auto &table : tables.tables) {
+    if (matches.find(table.name) != matches.end()) {
+      continue;
+    }
+    record(table.name, {"create-table", table.name, "", ""});
+    std::vector<std::string> definitions;
+    for (const auto &column : table.columns) {
+      definitions.push_back(column_definition(column));
+    }
+    for (const auto &key : table.keys) {
+      definitions.push_back(key_definition(key));
+    }
+    sql += "\nCREATE TABLE `" + db_name + "`.`" + table.name + "` (\n    " +
+           join(definitions, ",\n    ") + "\n) ENGINE=" + table.engine +
+           " DEFAULT CHARSET=utf8 COMMENT '" + table.id + "'" +
+           (table.partitioning && table.partitioning->type != "NONE"
+                ? ' ' + table.partitioning->definition
+                : "") +
+           ";\n";
+    flush();
+  }
+
+  // Apply table properties, columns and keys
+  for (const auto &table : tables.tables) {
+    auto match = matches.find(table.name);
+    if (match == matches.end()) {
+      continue;
+    }
+    const auto &live_table = live_tables[live_ids[table.id]];
+    std::vector<std::string> alters;
+    alter_cost = 0;
+    std::map<std::string, const jsonio::json *> live_columns;
+    std::map<std::string, std::size_t> live_positions;
+    for (auto live_column : live_table.columns) {
+      const auto &id = (*live_column)["comment"].get_string();
+      if (std::find_if(table.columns.begin(), table.columns.end(),
+                       [&](auto &column) { return column.id == id; }) ==
+          table.columns.end()) {
+        alters.push_back("DROP COLUMN `" + (*live_column)["name"].get_string() +
+                         '`');
+        record(table.name, {"drop-column", (*live_column)["name"].get_string(),
+                            "", "inplace"});
+      } else {
+        live_columns[id] = live_column;
+        live_positions.emplace(id, live_positions.size());
+      }
+    }
+    // Only the existing columns off the longest run already in order move,
+    // and the new columns followed by existing ones
+    std::vector<std::size_t> sequence;
+    std::size_t appended = table.columns.size();
+    for (std::size_t i = 0; i < table.columns.size(); ++i) {
+      auto live_position = live_positions.find(table.columns[i].id);
+      if (live_position != live_positions.end()) {
+        sequence.push_back(live_position->second);
+        appended = table.columns.size();
+      } else if (appended == table.columns.size()) {
+        appended = i;
+      }
+    }
+    auto kept = longest_increasing(sequence);
+    std::string position = "FIRST";
+    for (std::size_t i = 0, k = 0; i < table.columns.size(); ++i) {
+      const auto &column = table.columns[i];
+      auto live_column = live_columns.find(column.id);
+      auto moved = !options.ignore_column_order &&
+                   (live_column == live_columns.end() ? i < appended
+                                                      : !kept[k++]);
+      auto placement = moved ? ' ' + position : "";
+      position = "AFTER `" + column.name + '`';
+      if (live_column == live_columns.end()) {
+        alters.push_back("ADD COLUMN " + column_definition(column) + placement);
+        record(table.name, {"add-column", column.name, "",
+                            column.auto_increment ? "copy" : "instant"});
+        continue;
+      }
+      const auto &old = *live_column->second;
+      auto renamed = old["name"].get_string() != column.name;
+      auto rebuilt = !same(old["type"].get_string(), column.type) ||
+                     (old["extra"].get_string().find("auto_increment") !=
+                      std::string::npos) != column.auto_increment;
+      auto nullable = old["null"].get_string() != (column.null ? "YES" : "NO");
+      auto modified = rebuilt || nullable ||
+                      !same_default(old.at("default"), column.default_value);
+      if (moved || renamed || modified) {
+        auto operation = modified  ? "modify-column"
+                         : renamed ? "rename-column"
+                                   : "move-column";
+        auto algorithm = rebuilt             ? "copy"
+                         : moved || nullable ? "inplace"
+                                             : "instant";
+        record(table.name, {operation, column.name,
+                            renamed ? old["name"].get_string() : "",
+                            algorithm});
+        alters.push_back(
+            (old["name"].get_string() == column.name
+                 ? "MODIFY COLUMN "
+                 : "CHANGE COLUMN `" + old["name"].get_string() + "` ") +
+            column_definition(column) + placement);
+      }
+    }
+    std::set<std::string> all_keys;
+    for (const auto &key : table.keys) {
+      all_keys.insert(key.name);
+      auto add = "ADD " + key_definition(key);
+      // Full text and spatial indexes are built by a table copy
+      plan_operation planned_add{
+          "add-index", key.name, "",
+          key.type.find("fulltext") == 0 || key.type.find("spatial") == 0
+              ? "copy"
+              : "inplace"};
+      auto index = live_table.indexes.find(key.name);
+      if (index == live_table.indexes.end()) {
+        alters.push_back(add);
+        record(table.name, planned_add);
+      } else if (new_columns((*live_table.table)["name"].get_string(),
+                             (*index->second)["columns"]) !=
+                 key.quoted_columns) {
+        alters.push_back("DROP INDEX `" + key.name + '`');
+        alters.push_back(add);
+        record(table.name, {"drop-index", key.name, "", "inplace"});
+        record(table.name, planned_add);
+      } else if (visible(*index->second) == key.invisible) {
+        alters.push_back("ALTER INDEX `" + key.name +
+                         (key.invisible ? "` INVISIBLE" : "` VISIBLE"));
+        record(table.name, {key.invisible ? "hide-index" : "show-index",
+                            key.name, "", "inplace"});
+      }
+    }
+    for (const auto &[name, index] : live_table.indexes) {
+      if (all_keys.find(name) == all_keys.end() &&
+          (*index)["unique"].get_string() == "YES") {
+        // Staged drops hide the key, and drop it once found hidden
+        if (options.staged_index_drops && name != "PRIMARY" &&
+            visible(*index)) {
+          alters.push_back("ALTER INDEX `" + name + "` INVISIBLE");
+          record(table.name, {"hide-index", name, "", "inplace"});
+          continue;
+        }
+        alters.push_back("DROP INDEX `" + name + '`');
+        record(table.name, {"drop-index", name, "",
+                            name == "PRIMARY" ? "copy" : "inplace"});
+      }
+    }
+    if (!same((*live_table.table)["engine"].get_string(), table.engine)) {
+      alters.push_back("ENGINE=" + table.engine);
+      record(table.name, {"change-engine", table.engine,
+                          (*live_table.table)["engine"].get_string(), "copy"});
+    }
+    if (auto clause = algorithm_clause(table, alter_cost);
+        !alters.empty() && !clause.empty()) {
+      alters.push_back(clause);
+    }
+    if (!alters.empty()) {
+      sql += "\nALTER TABLE `" + db_name + "`.`" + table.name + "`\n    " +
+             join(alters, ",\n    ") + ";\n";
+    } else if (options.report) {
+      sql += note + "Table \"" + table.name + "\" is ok.\n";
+    }
+    if (table.partitioning && live_partitions) {
+      // Partition maintenance takes its own ALTER TABLE statements
+      std::vector<plan_operation> operations;
+      for (const auto &change :
+           partition_changes(table, live_table.partitions, operations)) {
+        sql += "\nALTER TABLE `" + db_name + "`.`" + table.name + "` " +
+               change + ";\n";
+      }
+      for (const auto &operation : operations) {
+        record(table.name, operation);
+      }
+    }
+    flush();
+  }
+
+  // Create foreign keys. Under a policy below copy, the foreign keys of an
+  // existing table are added in place without checks, after a statement
+  // failing on a row without its parent, as replicate_sql() does it.
+  for (const auto &table : tables.tables) {
+    const auto &policy =
+        table.algorithm.empty() ? options.algorithm : table.algorithm;
+    auto unchecked = matches.count(table.name) && !policy.empty() &&
+                     algorithm_rank(policy) < 2;
+    std::vector<std::string> adds, orphans;
+    for (const auto &key : table.foreign_keys) {
+      if (kept_foreign_keys.find(key.name) != kept_foreign_keys.end()) {
+        continue;
+      }
+      adds.push_back("ADD CONSTRAINT `" + key.name + "` FOREIGN KEY (" +
+                     key.quoted_columns + ") REFERENCES `" + db_name + "`.`" +
+                     key.table + "` (" + key.quoted_keys + ") ON UPDATE " +
+                     key.on_update + " ON DELETE " + key.on_delete);
+      orphans.push_back("DO (SELECT 1 UNION ALL (" +
+                        orphan_select(db_name, table, key) + "));");
+      record(table.name, {"add-foreign-key", key.name, "",
+                          !matches.count(table.name) ? ""
+                          : unchecked                ? "inplace"
+                                                     : "copy"});
+    }
+    if (!adds.empty() && unchecked) {
+      // More than one row, and an error, when a row lacks its parent
+      sql += '\n' + join(orphans, "\n") +
+             "\nSET @sql_fk_checks = @@foreign_key_checks;"
+             "\nSET foreign_key_checks = 0;";
+    }
+    if (auto clause = algorithm_clause(table, unchecked ? 1 : 2);
+        !adds.empty() && matches.count(table.name) && !clause.empty()) {
+      adds.push_back(clause);
+    }
+    if (!adds.empty()) {
+      sql += "\nALTER TABLE `" + db_name + "`.`" + table.name + "`\n    " +
+             join(adds, ",\n    ") + ";\n";
+    }
+    if (!adds.empty() && unchecked) {
+      sql += "SET foreign_key_checks = @sql_fk_checks;\n";
+    }
+    flush();
+  }
+
+  // Create views, after the views they join. A view in place is only
+  // replaced when its definition differs, and always with a snapshot
+  // exported before the definitions were added.
+  std::map<std::string, std::string> live_definitions;
+  if (auto views = live.at("views"); views) {
+    for (const auto &view : views->get_array()) {
+      live_definitions[view["name"].get_string()] =
+          view_text(db_name, view["definition"].get_string());
+    }
+  }
+  for (const auto &[t, v] : tables.view_order) {
+    const auto &table = tables.tables[t];
+    const auto &view = table.views[v];
+    auto definition = live_definitions.find(view.name);
+    if (definition != live_definitions.end() &&
+        definition->second ==
+            view_text(db_name, view_select(db_name, table, view))) {
+      if (options.report) {
+        sql += note + "View \"" + view.name + "\" is ok.\n";
+      }
+      continue;
+    }
+    sql += '\n' + view_statement(db_name, table, view) + '\n';
+    flush();
+  }
+
+  // Insert rows
+  for (const auto &table : tables.tables) {
+    if (table.rows.empty()) {
+      continue;
+    }
+    auto existing = matches.find(table.name) != matches.end();
+    auto reconcile =
+        existing && options.reconcile_rows && !table.primary.empty();
+    record(table.name, {reconcile ? "reconcile-rows" : "insert-rows", "", "",
+                        "", table.rows.size()});
+    sql += '\n';
+    if (reconcile) {
+      for (const auto &statement : reconcile_statements(
+               db_name, table, options.batch_rows, options.batch_bytes,
+               options.delete_stale_rows)) {
+        sql += statement + '\n';
+        flush();
+      }
+      continue;
+    }
+    if (existing) {
+      sql += "set @row_count = (SELECT COUNT(*) FROM `" + db_name + "`.`" +
+             table.name + "`);\n";
+    }
+    for (const auto &batch :
+         row_batches(table.rows, options.batch_rows, options.batch_bytes)) {
+      // Existing tables read the batch as a table value constructor, so the
+      // empty check still applies to the whole multi-row INSERT
+      auto values = (existing ? "ROW(" : "(") +
+                    join(batch.rows, existing ? "), ROW(" : "), (") + ")";
+      sql += "INSERT `" + db_name + "`.`" + table.name + "`(" + batch.columns +
+             ")" +
+             (existing ? " SELECT * FROM (VALUES " + values +
+                             ") AS `rows` WHERE @row_count = 0"
+                       : " VALUES" + values) +
+             ";\n";
+      flush();
+    }
+  }
+
+  // Apply users
+  std::set<std::string> live_users;
+  for (const auto &user : live["users"].get_array()) {
+    live_users.insert(user.get_string());
+  }
+  std::map<std::string, std::map<std::string, std::string>> live_grants;
+  for (const auto &grant : live["grants"].get_array()) {
+    live_grants[grant["user"].get_string()][grant["table"].get_string()] =
+        grant["privileges"].get_string();
+  }
+  for (const auto &user : users.get_array()) {
+    const auto &name = user["name"].get_string();
+    if (live_users.find(name) == live_users.end()) {
+      sql += "\nCREATE USER '" + name + "' ACCOUNT LOCK;\n";
+    }
+    auto &grants = live_grants[name];
+
+    // Revoke permissions of extra tables
+    for (const auto &[subject, privileges] : grants) {
+      auto &permissions = user["permissions"].get_array();
+      if (std::find_if(permissions.begin(), permissions.end(), [&](auto &p) {
+            return p["subject"].get_string() == subject;
+          }) == permissions.end()) {
+        sql += "REVOKE IF EXISTS SELECT, INSERT, UPDATE, DELETE ON `" +
+               db_name + "`.`" + subject + "` FROM '" + name + "';\n";
+      }
+    }
+
+    // Adjust permissions
+    for (const auto &permission : user["permissions"].get_array()) {
+      std::string grant_operations, revoke_operations;
+      auto &permissions = permission["operations"].get_array();
+      for (auto operation : {"Select", "Insert", "Update", "Delete"}) {
+        if (std::find_if(permissions.begin(), permissions.end(), [&](auto &s) {
+              return strcasecmp(s.get_string().c_str(), operation) == 0;
+            }) != permissions.end()) {
+          if (!grant_operations.empty()) {
+            grant_operations += ",";
+          }
+          grant_operations += operation;
+        } else {
+          if (!revoke_operations.empty()) {
+            revoke_operations += ",";
+          }
+          revoke_operations += operation;
+        }
+      }
+      const auto &subject = permission["subject"].get_string();
+      auto old_grant = grants.find(subject);
+      if (old_grant != grants.end() &&
+          same(old_grant->second, grant_operations)) {
+        if (options.report) {
+          sql += note + "Permissions on \"" + subject + "\" for \"" + name +
+                 "\" are ok.\n";
+        }
+        continue;
+      }
+      if (!grant_operations.empty()) {
+        sql += "GRANT " + grant_operations + " ON `" + db_name + "`.`" +
+               subject + "` TO '" + name + "';\n";
+      }
+      if (!revoke_operations.empty() && old_grant != grants.end()) {
+        sql += "REVOKE IF EXISTS " + revoke_operations + " ON `" + db_name +
+               "`.`" + subject + "` FROM '" + name + "';\n";
+      }
+    }
+    flush();
+  }
+  flush();
+}
+
+} // namespace
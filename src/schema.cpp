@@ -0,0 +1,672 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <string_view>
+#include <unordered_set>
+
+#include "common.h"
+#include "schema.h"
+
+namespace {
+
+// Whether the value is free of the quotes delimiting the identifiers and
+// values of the generated SQL. Every byte is checked without branching, so
+// the loop vectorizes and the string is scanned once.
+bool safe(const std::string &value) {
+  bool bad = false;
+  for (const char c : value) {
+    bad |= (c == '\'') | (c == '`');
+  }
+  return !bad;
+}
+
+std::vector<std::string> strings(const jsonio::json &items) {
+  std::vector<std::string> values;
+  values.reserve(items.get_array().size());
+  for (const auto &item : items.get_array()) {
+    values.push_back(item.get_string());
+  }
+  return values;
+}
+
+std::string quoted(const std::vector<std::string> &names) {
+  std::string list;
+  for (const auto &name : names) {
+    if (!list.empty()) {
+      list += ", ";
+    }
+    list += '`' + name + '`';
+  }
+  return list;
+}
+
+// Ids of the named columns, keeping the name of an unknown column
+std::string column_ids_of(const schema_table &table,
+                          const std::vector<std::string> &names) {
+  std::string ids;
+  for (const auto &name : names) {
+    if (!ids.empty()) {
+      ids += ',';
+    }
+    auto column = std::find_if(
+        table.columns.begin(), table.columns.end(),
+        [&](const auto &column) { return column.name == name; });
+    ids += column == table.columns.end() ? name : column->id;
+  }
+  return ids;
+}
+
+// 64 bit FNV-1a hash of the definition of the table. Every field is followed
+// by a zero byte, so moving text between fields changes the hash.
+std::string fingerprint_of(const schema_table &table) {
+  std::uint64_t hash = 0xcbf29ce484222325;
+  auto add = [&](const std::string &field) {
+    for (const char c : field) {
+      hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+    }
+    hash *= 0x100000001b3;
+  };
+  // Bump the version when the generated checks change
+  add("sqlr 2");
+  add(table.name);
+  add(table.engine);
+  for (const auto &column : table.columns) {
+    add(column.id);
+    add(column.definition);
+  }
+  for (const auto &key : table.keys) {
+    add(key.name);
+    add(key.type);
+    add(key.column_ids);
+    add(key.invisible ? "invisible" : "visible");
+  }
+  for (const auto &key : table.foreign_keys) {
+    add(key.name);
+    add(key.table);
+    add(key.column_ids);
+    add(key.quoted_keys);
+    add(key.on_update);
+    add(key.on_delete);
+  }
+  add(table.partitioning ? table.partitioning->definition : "");
+  for (const auto &view : table.views) {
+    add(view.name);
+    for (const auto &column : view.columns) {
+      add(column);
+    }
+    for (const auto &joint : view.joints) {
+      add(joint.type);
+      add(joint.table);
+      add(joint.as);
+      for (const auto &on : joint.ons) {
+        add(on.base_table);
+        add(on.base_column);
+        add(on.foreign);
+      }
+      for (const auto &column : joint.columns) {
+        add(column.name);
+        add(column.as);
+      }
+    }
+  }
+  std::string hex(16, '0');
+  for (auto digit = hex.rbegin(); digit != hex.rend(); ++digit, hash >>= 4) {
+    *digit = "0123456789abcdef"[hash & 0xf];
+  }
+  return hex;
+}
+
+// Largest size in bytes of a value of the column type in an InnoDB index,
+// with utf8 characters of three bytes.
+std::size_t value_bytes(const std::string &type) {
+  auto name = type.substr(0, type.find_first_of(" ("));
+  std::transform(name.begin(), name.end(), name.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  std::size_t length = 0;
+  if (auto open = type.find('('); open != std::string::npos) {
+    length = std::strtoul(type.c_str() + open + 1, nullptr, 10);
+  }
+  static const std::map<std::string, std::size_t> fixed{
+      {"tinyint", 1},  {"smallint", 2}, {"mediumint", 3}, {"int", 4},
+      {"integer", 4},  {"bigint", 8},   {"float", 4},     {"double", 8},
+      {"date", 3},     {"time", 3},     {"datetime", 5},  {"timestamp", 4},
+      {"year", 1},     {"enum", 2},     {"set", 8},       {"bit", 8}};
+  if (auto size = fixed.find(name); size != fixed.end()) {
+    return size->second;
+  }
+  if (name == "decimal" || name == "numeric") {
+    return length / 2 + 1;
+  }
+  if (name == "char") {
+    return length * 3;
+  }
+  if (name == "varchar") {
+    return length * 3 + 2;
+  }
+  if (name == "binary") {
+    return length;
+  }
+  if (name == "varbinary") {
+    return length + 2;
+  }
+  // Prefix of the text and blob columns
+  return 767;
+}
+
+// Whether the columns of the foreign key start a key of the table, in order,
+// so the key serves the lookups of the foreign key.
+bool indexed(const schema_table &table, const schema_foreign_key &key) {
+  return std::any_of(
+      table.keys.begin(), table.keys.end(), [&](const auto &candidate) {
+        return candidate.columns.size() >= key.columns.size() &&
+               std::equal(key.columns.begin(), key.columns.end(),
+                          candidate.columns.begin());
+      });
+}
+
+} // namespace
+
+schema compile_schema(const jsonio::json &tables) {
+  std::vector<std::string> errors;
+  auto fail = [&](const std::string &path, const char *message) {
+    errors.push_back(std::string{"Publish MySQL: "} + message + " at " + path);
+  };
+  // Paths are only built for the reported errors
+  auto check = [&](const std::string &value, const auto &path) {
+    if (!safe(value)) {
+      fail(path(), "Bad Character");
+    }
+  };
+  auto check_all = [&](const std::vector<std::string> &values,
+                       const auto &path) {
+    for (std::size_t i = 0; i < values.size(); ++i) {
+      if (!safe(values[i])) {
+        fail(path() + '[' + std::to_string(i) + ']', "Bad Character");
+      }
+    }
+  };
+
+  schema model;
+  model.tables.reserve(tables.get_array().size());
+  std::unordered_set<std::string_view> table_ids;
+  for (std::size_t t = 0; const auto &table : tables.get_array()) {
+    auto table_path = [&, t](const std::string &field) {
+      return '[' + std::to_string(t) + "]." + field;
+    };
+    ++t;
+    auto &target = model.tables.emplace_back();
+    target.id = table["id"].get_string();
+    target.name = table["name"].get_string();
+    check(target.name, [&] { return table_path("name"); });
+    if (target.name.rfind(bad_prefix, 0) == 0) {
+      fail(table_path("name"), "Table Bad Prefix");
+    }
+    check(target.id, [&] { return table_path("id"); });
+    if (!table_ids.insert(table["id"].get_string()).second) {
+      fail(table_path("id"), "Repeated Table Id");
+    }
+    auto engine = table.at("engine");
+    target.engine = engine ? engine->get_string() : "InnoDB";
+    check(target.engine, [&] { return table_path("engine"); });
+    if (auto algorithm = table.at("algorithm"); algorithm) {
+      target.algorithm = algorithm->get_string();
+      if (target.algorithm != "instant" && target.algorithm != "inplace" &&
+          target.algorithm != "copy") {
+        fail(table_path("algorithm"), "Bad Algorithm");
+      }
+    }
+
+    target.columns.reserve(table["columns"].get_array().size());
+    std::unordered_set<std::string_view> column_ids;
+    for (std::size_t c = 0; const auto &column : table["columns"].get_array()) {
+      auto column_path = [&, c](const std::string &field) {
+        return table_path("columns[" + std::to_string(c) + "]." + field);
+      };
+      ++c;
+      auto &target_column = target.columns.emplace_back();
+      target_column.id = column["id"].get_string();
+      target_column.name = column["name"].get_string();
+      target_column.type = column["type"].get_string();
+      check(target_column.name, [&] { return column_path("name"); });
+      if (target_column.name.rfind(bad_prefix, 0) == 0) {
+        fail(column_path("name"), "Column Bad Prefix");
+      }
+      check(target_column.type, [&] { return column_path("type"); });
+      check(target_column.id, [&] { return column_path("id"); });
+      if (target_column.id.empty()) {
+        fail(column_path("id"), "Column No Id");
+      }
+      if (auto default_value = column.at("default"); default_value) {
+        target_column.default_value = default_value->get_string();
+        check(*target_column.default_value,
+              [&] { return column_path("default"); });
+      }
+      if (!column_ids.insert(column["id"].get_string()).second) {
+        fail(column_path("id"), "Repeated Column Id");
+      }
+      target_column.null = column.at("null") && column["null"].get_bool();
+      target_column.auto_increment =
+          column.at("auto") && column["auto"].get_bool();
+      target_column.definition =
+          '`' + target_column.name + "` " + target_column.type +
+          (target_column.default_value
+               ? " DEFAULT " + *target_column.default_value
+               : "") +
+          (target_column.null ? " null" : " not null") +
+          (target_column.auto_increment ? " auto_increment" : "");
+    }
+
+    if (auto keys = table.at("keys"); keys) {
+      std::unordered_set<std::string_view> key_names;
+      for (std::size_t k = 0; const auto &key : keys->get_array()) {
+        auto key_path = [&, k](const std::string &field) {
+          return table_path("keys[" + std::to_string(k) + "]." + field);
+        };
+        ++k;
+        auto &target_key = target.keys.emplace_back();
+        target_key.name = key["name"].get_string();
+        target_key.type = key["type"].get_string();
+        target_key.columns = strings(key["columns"]);
+        if (target_key.columns.empty()) {
+          fail(key_path("columns"), "No Key Column");
+        }
+        check_all(target_key.columns, [&] { return key_path("columns"); });
+        check(target_key.name, [&] { return key_path("name"); });
+        check(target_key.type, [&] { return key_path("type"); });
+        if (!key_names.insert(key["name"].get_string()).second) {
+          fail(key_path("name"), "Repeated Key Name");
+        }
+        if (target_key.type == "primary key" &&
+            target_key.name != "PRIMARY") {
+          fail(key_path("name"), "Invalid Primary Key Name");
+        }
+        target_key.invisible =
+            key.at("invisible") && key["invisible"].get_bool();
+        if (target_key.invisible && target_key.type == "primary key") {
+          fail(key_path("invisible"), "Invisible Primary Key");
+        }
+        target_key.quoted_columns = quoted(target_key.columns);
+        target_key.column_ids = column_ids_of(target, target_key.columns);
+        if (target_key.type == "primary key") {
+          target.primary = target_key.columns;
+        }
+      }
+    }
+
+    if (auto foreign_keys = table.at("foreign-keys"); foreign_keys) {
+      for (std::size_t k = 0; const auto &key : foreign_keys->get_array()) {
+        auto key_path = [&, k](const std::string &field) {
+          return table_path("foreign-keys[" + std::to_string(k) + "]." + field);
+        };
+        ++k;
+        auto &target_key = target.foreign_keys.emplace_back();
+        target_key.name = key["name"].get_string();
+        target_key.table = key["table"].get_string();
+        target_key.columns = strings(key["columns"]);
+        target_key.keys = strings(key["keys"]);
+        target_key.on_update = key["update"].get_string();
+        target_key.on_delete = key["delete"].get_string();
+        check(target_key.name, [&] { return key_path("name"); });
+        check(target_key.on_delete, [&] { return key_path("delete"); });
+        check(target_key.on_update, [&] { return key_path("update"); });
+        check(target_key.table, [&] { return key_path("table"); });
+        if (target_key.columns.empty()) {
+          fail(key_path("columns"), "No ForeignKey Column");
+        }
+        check_all(target_key.columns, [&] { return key_path("columns"); });
+        if (target_key.keys.empty()) {
+          fail(key_path("keys"), "No ForeignKey Key");
+        }
+        check_all(target_key.keys, [&] { return key_path("keys"); });
+        target_key.quoted_columns = quoted(target_key.columns);
+        target_key.quoted_keys = quoted(target_key.keys);
+        target_key.column_ids = column_ids_of(target, target_key.columns);
+      }
+    }
+
+    if (auto partitioning = table.at("partitioning"); partitioning) {
+      auto partitioning_path = [&](const std::string &field) {
+        return table_path("partitioning." + field);
+      };
+      auto &target_partitioning = target.partitioning.emplace();
+      auto &type = target_partitioning.type;
+      type = (*partitioning)["type"].get_string();
+      std::transform(type.begin(), type.end(), type.begin(),
+                     [](unsigned char c) { return std::toupper(c); });
+      auto ranged = type == "RANGE" || type == "RANGE COLUMNS" ||
+                    type == "LIST" || type == "LIST COLUMNS";
+      auto hashed = type == "HASH" || type == "LINEAR HASH" || type == "KEY" ||
+                    type == "LINEAR KEY";
+      if (!ranged && !hashed && type != "NONE") {
+        fail(partitioning_path("type"), "Bad Partitioning Type");
+      }
+      if (auto expression = partitioning->at("expression"); expression) {
+        target_partitioning.expression = expression->get_string();
+        check(target_partitioning.expression,
+              [&] { return partitioning_path("expression"); });
+      } else if (ranged || type == "HASH" || type == "LINEAR HASH") {
+        fail(partitioning_path("expression"), "No Partitioning Expression");
+      }
+      auto partitions = partitioning->at("partitions");
+      if (ranged && (!partitions || partitions->get_array().empty())) {
+        fail(partitioning_path("partitions"), "No Partition");
+      }
+      if (!ranged && partitions) {
+        fail(partitioning_path("partitions"), "Partitions Without Range");
+      }
+      std::unordered_set<std::string_view> partition_names;
+      for (std::size_t p = 0; ranged && partitions &&
+                              p < partitions->get_array().size();
+           ++p) {
+        const auto &partition = partitions->get_array()[p];
+        auto partition_path = [&, p](const std::string &field) {
+          return partitioning_path("partitions[" + std::to_string(p) + "]." +
+                                   field);
+        };
+        auto &target_partition =
+            target_partitioning.partitions.emplace_back();
+        target_partition.name = partition["name"].get_string();
+        target_partition.values = partition["values"].get_string();
+        check(target_partition.name, [&] { return partition_path("name"); });
+        check(target_partition.values,
+              [&] { return partition_path("values"); });
+        if (!partition_names.insert(partition["name"].get_string()).second) {
+          fail(partition_path("name"), "Repeated Partition Name");
+        }
+        // MAXVALUE bounds a plain range without parentheses
+        auto values = type == "RANGE" &&
+                              partition_text(target_partition.values) ==
+                                  "maxvalue"
+                          ? std::string{" MAXVALUE"}
+                          : " (" + target_partition.values + ')';
+        target_partition.definition =
+            "PARTITION `" + target_partition.name + "` VALUES " +
+            (type.find("RANGE") == 0 ? "LESS THAN" : "IN") + values;
+      }
+      if (auto count = partitioning->at("count"); count && hashed) {
+        if (auto number = count->get_int(); number > 0) {
+          target_partitioning.count = number;
+        }
+      } else if (count) {
+        fail(partitioning_path("count"), "Count Without Hash");
+      }
+      if (hashed && target_partitioning.count == 0) {
+        fail(partitioning_path("count"), "Bad Partition Count");
+      }
+      if (type == "NONE") {
+        target_partitioning.definition = "REMOVE PARTITIONING";
+      } else {
+        target_partitioning.definition =
+            "PARTITION BY " + type + " (" + target_partitioning.expression +
+            ')';
+        if (hashed) {
+          target_partitioning.definition +=
+              " PARTITIONS " + std::to_string(target_partitioning.count);
+        }
+        std::string definitions;
+        for (const auto &partition : target_partitioning.partitions) {
+          definitions += (definitions.empty() ? "" : ", ") +
+                         partition.definition;
+        }
+        if (ranged) {
+          target_partitioning.definition += " (" + definitions + ')';
+        }
+        // InnoDB doesn't support foreign keys on partitioned tables
+        if (!target.foreign_keys.empty()) {
+          fail(table_path("foreign-keys"), "Partitioned Foreign Key");
+        }
+      }
+    }
+
+    if (auto views = table.at("views"); views) {
+      for (std::size_t v = 0; const auto &view : views->get_array()) {
+        auto view_path = [&, v](const std::string &field) {
+          return table_path("views[" + std::to_string(v) + "]." + field);
+        };
+        ++v;
+        auto &target_view = target.views.emplace_back();
+        target_view.name = view["name"].get_string();
+        target_view.columns = strings(view["columns"]);
+        check(target_view.name, [&] { return view_path("name"); });
+        check_all(target_view.columns, [&] { return view_path("columns"); });
+        for (std::size_t j = 0;
+             const auto &joint : view["joints"].get_array()) {
+          auto joint_path = [&, j](const std::string &field) {
+            return view_path("joints[" + std::to_string(j) + "]." + field);
+          };
+          ++j;
+          auto &target_joint = target_view.joints.emplace_back();
+          target_joint.type = joint["type"].get_string();
+          target_joint.table = joint["table"].get_string();
+          target_joint.as = joint["as"].get_string();
+          if (target_joint.type != "inner" &&
+              target_joint.type != "left outer" &&
+              target_joint.type != "right outer") {
+            fail(joint_path("type"), "Bad Join Type");
+          }
+          check(target_joint.table, [&] { return joint_path("table"); });
+          check(target_joint.as, [&] { return joint_path("as"); });
+          for (std::size_t o = 0; const auto &on : joint["ons"].get_array()) {
+            auto on_path = [&, o](const std::string &field) {
+              return joint_path("ons[" + std::to_string(o) + "]." + field);
+            };
+            ++o;
+            auto &target_on = target_joint.ons.emplace_back(
+                schema_on{on["base"]["table"].get_string(),
+                          on["base"]["column"].get_string(),
+                          on["foreign"].get_string()});
+            check(target_on.base_table, [&] { return on_path("base.table"); });
+            check(target_on.base_column,
+                  [&] { return on_path("base.column"); });
+            check(target_on.foreign, [&] { return on_path("foreign"); });
+          }
+          for (std::size_t c = 0;
+               const auto &clm : joint["columns"].get_array()) {
+            auto clm_path = [&, c](const std::string &field) {
+              return joint_path("columns[" + std::to_string(c) + "]." + field);
+            };
+            ++c;
+            auto &target_clm = target_joint.columns.emplace_back(
+                schema_join_column{clm["name"].get_string(),
+                                   clm["as"].get_string()});
+            check(target_clm.name, [&] { return clm_path("name"); });
+            check(target_clm.as, [&] { return clm_path("as"); });
+          }
+        }
+      }
+    }
+
+    if (auto rows = table.at("rows"); rows) {
+      target.rows.reserve(rows->get_array().size());
+      for (std::size_t r = 0; const auto &row : rows->get_array()) {
+        auto &target_row = target.rows.emplace_back();
+        for (const auto &clm : row.get_object()) {
+          if (!safe(clm.first)) {
+            fail(table_path("rows[" + std::to_string(r) + "]." + clm.first),
+                 "Bad Character");
+          }
+          target_row.names.push_back(clm.first);
+          target_row.values.push_back(clm.second.get_string());
+        }
+        ++r;
+      }
+    }
+    target.fingerprint = fingerprint_of(target);
+  }
+
+  // Nor can a partitioned InnoDB table be referenced by a foreign key
+  for (std::size_t t = 0; t < model.tables.size(); ++t) {
+    const auto &foreign_keys = model.tables[t].foreign_keys;
+    for (std::size_t k = 0; k < foreign_keys.size(); ++k) {
+      auto referenced = std::find_if(
+          model.tables.begin(), model.tables.end(), [&](const auto &table) {
+            return table.name == foreign_keys[k].table;
+          });
+      if (referenced != model.tables.end() && referenced->partitioning &&
+          referenced->partitioning->type != "NONE") {
+        fail('[' + std::to_string(t) + "].foreign-keys[" + std::to_string(k) +
+                 "].table",
+             "Foreign Key To Partitioned Table");
+      }
+    }
+  }
+
+  // Order the views by a depth first walk of the views they join
+  std::map<std::string, std::pair<std::size_t, std::size_t>> views;
+  for (std::size_t t = 0; t < model.tables.size(); ++t) {
+    for (std::size_t v = 0; v < model.tables[t].views.size(); ++v) {
+      views.emplace(model.tables[t].views[v].name, std::pair{t, v});
+    }
+  }
+  std::set<std::pair<std::size_t, std::size_t>> visiting, visited;
+  auto visit = [&](const auto &visit, std::pair<std::size_t, std::size_t> at) {
+    if (visited.count(at)) {
+      return;
+    }
+    if (!visiting.insert(at).second) {
+      fail('[' + std::to_string(at.first) + "].views[" +
+               std::to_string(at.second) + ']',
+           "Circular View");
+      return;
+    }
+    for (const auto &joint :
+         model.tables[at.first].views[at.second].joints) {
+      if (auto view = views.find(joint.table); view != views.end()) {
+        visit(visit, view->second);
+      }
+    }
+    visited.insert(at);
+    model.view_order.push_back(at);
+  };
+  for (std::size_t t = 0; t < model.tables.size(); ++t) {
+    for (std::size_t v = 0; v < model.tables[t].views.size(); ++v) {
+      visit(visit, std::pair{t, v});
+    }
+  }
+
+  if (!errors.empty()) {
+    std::string message;
+    for (const auto &error : errors) {
+      if (!message.empty()) {
+        message += '\n';
+      }
+      message += error;
+    }
+    throw std::runtime_error(message);
+  }
+  return model;
+}
+
+std::vector<std::string> unindexed_foreign_keys(const schema &tables) {
+  std::vector<std::string> found;
+  for (std::size_t t = 0; t < tables.tables.size(); ++t) {
+    const auto &table = tables.tables[t];
+    for (std::size_t k = 0; k < table.foreign_keys.size(); ++k) {
+      if (!indexed(table, table.foreign_keys[k])) {
+        found.push_back("Publish MySQL: Unindexed Foreign Key at [" +
+                        std::to_string(t) + "].foreign-keys[" +
+                        std::to_string(k) + ']');
+      }
+    }
+  }
+  return found;
+}
+
+void index_foreign_keys(schema &tables) {
+  for (auto &table : tables.tables) {
+    auto indexes = table.keys.size();
+    for (const auto &key : table.foreign_keys) {
+      if (indexed(table, key)) {
+        continue;
+      }
+      // Named after the foreign key, like the index the server would add
+      auto name = key.name;
+      auto taken = [&](const auto &other) { return other.name == name; };
+      while (std::any_of(table.keys.begin(), table.keys.end(), taken)) {
+        name += '_';
+      }
+      table.keys.push_back({name, "index", key.columns, key.quoted_columns,
+                            column_ids_of(table, key.columns)});
+    }
+    if (table.keys.size() != indexes) {
+      table.fingerprint = fingerprint_of(table);
+    }
+  }
+}
+
+std::vector<std::string> redundant_keys(const schema &tables) {
+  std::vector<std::string> found;
+  for (std::size_t t = 0; t < tables.tables.size(); ++t) {
+    const auto &table = tables.tables[t];
+    auto path = [&](std::size_t k) {
+      return '[' + std::to_string(t) + "].keys[" + std::to_string(k) + ']';
+    };
+    auto ordered = [](const schema_key &key) {
+      return key.type.find("fulltext") != 0 && key.type.find("spatial") != 0;
+    };
+    auto unique = [](const schema_key &key) {
+      return key.type.find("unique") == 0 || key.type == "primary key";
+    };
+    auto starts = [](const schema_key &key, const schema_key &other) {
+      return key.columns.size() <= other.columns.size() &&
+             std::equal(key.columns.begin(), key.columns.end(),
+                        other.columns.begin());
+    };
+    // Secondary indexes also hold the primary key columns of every row
+    auto bytes = [&](const schema_key &key) {
+      auto names = key.columns;
+      for (const auto &name : table.primary) {
+        if (std::find(names.begin(), names.end(), name) == names.end()) {
+          names.push_back(name);
+        }
+      }
+      std::size_t total = 0;
+      for (const auto &name : names) {
+        for (const auto &column : table.columns) {
+          if (column.name == name) {
+            total += value_bytes(column.type);
+          }
+        }
+      }
+      return total;
+    };
+    for (std::size_t k = 0; k < table.keys.size(); ++k) {
+      const auto &key = table.keys[k];
+      if (!ordered(key)) {
+        continue;
+      }
+      for (std::size_t o = 0; o < table.keys.size(); ++o) {
+        const auto &other = table.keys[o];
+        if (o == k || !ordered(other) || !starts(key, other)) {
+          continue;
+        }
+        const char *problem = nullptr;
+        if (key.columns.size() == other.columns.size()) {
+          // Of two equal keys, the unique or else the first one is kept
+          if (unique(key) == unique(other) ? o < k : unique(other)) {
+            problem = "Duplicate Key";
+          }
+        } else if (!unique(key)) {
+          problem = "Prefix Covered Key";
+        }
+        if (problem) {
+          found.push_back("Publish MySQL: " + std::string{problem} + " at " +
+                          path(k) + " by " + path(o) + ", up to " +
+                          std::to_string(bytes(key)) + " bytes per row");
+          break;
+        }
+        // A unique key starting with the columns of another one
+        if (unique(key) && unique(other) &&
+            key.columns.size() < other.columns.size()) {
+          found.push_back("Publish MySQL: Redundant Unique Key at " +
+                          path(o) + " by " + path(k) + ", up to " +
+                          std::to_string(bytes(other)) + " bytes per row");
+        }
+      }
+    }
+  }
+  return found;
+}
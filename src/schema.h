@@ -0,0 +1,149 @@
+#ifndef SQLR_SCHEMA_H
+#define SQLR_SCHEMA_H
+
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <json.hpp>
+
+// Tables definition resolved once from the JSON input. Every phase of the
+// generators reads these structures instead of looking up the JSON objects.
+
+struct schema_column {
+  std::string id;
+  std::string name;
+  std::string type;
+  std::optional<std::string> default_value;
+  bool null = false;
+  bool auto_increment = false;
+  // `name` type [DEFAULT value] null|not null [auto_increment], without the
+  // comment holding the id.
+  std::string definition;
+};
+
+struct schema_key {
+  std::string name;
+  std::string type;
+  std::vector<std::string> columns;
+  // `a`, `b`
+  std::string quoted_columns;
+  // Ids of the columns, comma separated, to follow them through renames.
+  std::string column_ids;
+  // Kept up to date but ignored by the optimizer.
+  bool invisible = false;
+};
+
+struct schema_foreign_key {
+  std::string name;
+  std::string table;
+  std::vector<std::string> columns;
+  std::vector<std::string> keys;
+  std::string on_update;
+  std::string on_delete;
+  std::string quoted_columns;
+  std::string quoted_keys;
+  std::string column_ids;
+};
+
+struct schema_on {
+  std::string base_table;
+  std::string base_column;
+  std::string foreign;
+};
+
+struct schema_join_column {
+  std::string name;
+  std::string as;
+};
+
+struct schema_joint {
+  std::string type;
+  std::string table;
+  std::string as;
+  std::vector<schema_on> ons;
+  std::vector<schema_join_column> columns;
+};
+
+struct schema_view {
+  std::string name;
+  std::vector<std::string> columns;
+  std::vector<schema_joint> joints;
+};
+
+// Seed row as parallel lists of column names and SQL values.
+struct schema_row {
+  std::vector<std::string> names;
+  std::vector<std::string> values;
+};
+
+struct schema_partition {
+  std::string name;
+  // Bound of a range partition or values of a list partition, as written.
+  std::string values;
+  // PARTITION `name` VALUES ...
+  std::string definition;
+};
+
+struct schema_partitioning {
+  // RANGE, RANGE COLUMNS, LIST, LIST COLUMNS, HASH, LINEAR HASH, KEY,
+  // LINEAR KEY or NONE, as `PARTITION_METHOD` names them.
+  std::string type;
+  std::string expression;
+  // Partitions of a range or list partitioning, in order.
+  std::vector<schema_partition> partitions;
+  // Number of partitions of a hash or key partitioning.
+  std::size_t count = 0;
+  // PARTITION BY ..., or REMOVE PARTITIONING for NONE.
+  std::string definition;
+};
+
+struct schema_table {
+  std::string id;
+  std::string name;
+  std::string engine;
+  // Online DDL policy of the table, empty to follow the one of the run.
+  std::string algorithm;
+  std::vector<schema_column> columns;
+  std::vector<schema_key> keys;
+  std::vector<schema_foreign_key> foreign_keys;
+  std::vector<schema_view> views;
+  std::vector<schema_row> rows;
+  // Left to the server when missing.
+  std::optional<schema_partitioning> partitioning;
+  // Columns of the primary key, empty without a primary key.
+  std::vector<std::string> primary;
+  // Hex hash of the name, engine, columns, keys, foreign keys, views and
+  // partitioning, stable across runs and platforms.
+  std::string fingerprint;
+};
+
+struct schema {
+  std::vector<schema_table> tables;
+  // Indexes of the table and of the view of every view, each one after the
+  // views it joins.
+  std::vector<std::pair<std::size_t, std::size_t>> view_order;
+};
+
+// Validate the tables definition while resolving it into the schema model.
+// Every invalid field is reported with its JSON path, one per line of the
+// thrown error.
+schema compile_schema(const jsonio::json &tables);
+
+// Foreign keys whose columns don't start any key of their table, by their
+// JSON path. The server then adds an index by itself, or the joins and the
+// cascades of the foreign key scan the table.
+std::vector<std::string> unindexed_foreign_keys(const schema &tables);
+
+// Add an index of the columns of every such foreign key to its table, named
+// after the foreign key.
+void index_foreign_keys(schema &tables);
+
+// Keys costing writes and memory for nothing, by their JSON path and that of
+// the key making them useless, with the largest size of their entries:
+// duplicate keys of the same columns, keys whose columns start another key,
+// and unique keys starting with the columns of another unique key.
+std::vector<std::string> redundant_keys(const schema &tables);
+
+#endif // SQLR_SCHEMA_H
@@ -1,133 +1,578 @@
-#include <map>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <mutex>
 #include <sstream>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 #include <string.h>
 
+#include "common.h"
 #include "sqlr.h"
 
-void sanitize(const std::string &input, const char *bad_chars) {
-  while (*bad_chars) {
-    if (input.find(*bad_chars++) != std::string::npos) {
-      throw std::runtime_error(input.c_str());
+// INFORMATION_SCHEMA views copied into temporary tables in snapshot mode.
+struct information_table {
+  const char *name;
+  const char *copy;
+  const char *schema;
+  const char *columns;
+  const char *definition;
+};
+
+const information_table information_tables[] = {
+    {"TABLES", "_sql_tables", "TABLE_SCHEMA",
+     "`TABLE_SCHEMA`, `TABLE_NAME`, `TABLE_TYPE`, `ENGINE`, `TABLE_COMMENT`",
+     R"(
+    `TABLE_SCHEMA` varchar(64),
+    `TABLE_NAME` varchar(64),
+    `TABLE_TYPE` varchar(64),
+    `ENGINE` varchar(64),
+    `TABLE_COMMENT` varchar(2048),
+    index (`TABLE_NAME`),
+    index (`TABLE_COMMENT`(64)))"},
+    {"COLUMNS", "_sql_columns", "TABLE_SCHEMA",
+     "`TABLE_SCHEMA`, `TABLE_NAME`, `COLUMN_NAME`, `ORDINAL_POSITION`, "
+     "`COLUMN_DEFAULT`, `IS_NULLABLE`, `COLUMN_TYPE`, `EXTRA`, "
+     "`COLUMN_COMMENT`",
+     R"(
+    `TABLE_SCHEMA` varchar(64),
+    `TABLE_NAME` varchar(64),
+    `COLUMN_NAME` varchar(64),
+    `ORDINAL_POSITION` int unsigned,
+    `COLUMN_DEFAULT` text,
+    `IS_NULLABLE` varchar(3),
+    `COLUMN_TYPE` mediumtext,
+    `EXTRA` varchar(256),
+    `COLUMN_COMMENT` varchar(1024),
+    index (`TABLE_NAME`, `COLUMN_NAME`),
+    index (`TABLE_NAME`, `COLUMN_COMMENT`(64)))"},
+    {"STATISTICS", "_sql_statistics", "TABLE_SCHEMA",
+     "`TABLE_SCHEMA`, `TABLE_NAME`, `INDEX_SCHEMA`, `INDEX_NAME`, "
+     "`SEQ_IN_INDEX`, `COLUMN_NAME`, `IS_VISIBLE`",
+     R"(
+    `TABLE_SCHEMA` varchar(64),
+    `TABLE_NAME` varchar(64),
+    `INDEX_SCHEMA` varchar(64),
+    `INDEX_NAME` varchar(64),
+    `SEQ_IN_INDEX` int unsigned,
+    `COLUMN_NAME` varchar(64),
+    `IS_VISIBLE` varchar(3),
+    index (`TABLE_NAME`, `INDEX_NAME`))"},
+    {"KEY_COLUMN_USAGE", "_sql_key_column_usage", "TABLE_SCHEMA",
+     "`CONSTRAINT_SCHEMA`, `CONSTRAINT_NAME`, `TABLE_SCHEMA`, `TABLE_NAME`, "
+     "`COLUMN_NAME`, `ORDINAL_POSITION`, `POSITION_IN_UNIQUE_CONSTRAINT`, "
+     "`REFERENCED_TABLE_NAME`, `REFERENCED_COLUMN_NAME`",
+     R"(
+    `CONSTRAINT_SCHEMA` varchar(64),
+    `CONSTRAINT_NAME` varchar(64),
+    `TABLE_SCHEMA` varchar(64),
+    `TABLE_NAME` varchar(64),
+    `COLUMN_NAME` varchar(64),
+    `ORDINAL_POSITION` int unsigned,
+    `POSITION_IN_UNIQUE_CONSTRAINT` int unsigned,
+    `REFERENCED_TABLE_NAME` varchar(64),
+    `REFERENCED_COLUMN_NAME` varchar(64),
+    index (`CONSTRAINT_NAME`),
+    index (`TABLE_NAME`))"},
+    {"REFERENTIAL_CONSTRAINTS", "_sql_referential_constraints",
+     "CONSTRAINT_SCHEMA",
+     "`CONSTRAINT_SCHEMA`, `CONSTRAINT_NAME`, `TABLE_NAME`, "
+     "`REFERENCED_TABLE_NAME`, `UPDATE_RULE`, `DELETE_RULE`",
+     R"(
+    `CONSTRAINT_SCHEMA` varchar(64),
+    `CONSTRAINT_NAME` varchar(64),
+    `TABLE_NAME` varchar(64),
+    `REFERENCED_TABLE_NAME` varchar(64),
+    `UPDATE_RULE` varchar(64),
+    `DELETE_RULE` varchar(64),
+    index (`CONSTRAINT_NAME`),
+    index (`TABLE_NAME`))"},
+};
+
+namespace {
+
+// Forward the output to another buffer while counting its bytes.
+class counting_buffer : public std::streambuf {
+public:
+  explicit counting_buffer(std::streambuf *sink) : sink{sink} {}
+
+  std::size_t count = 0;
+
+protected:
+  int_type overflow(int_type c) override {
+    if (traits_type::eq_int_type(c, traits_type::eof())) {
+      return traits_type::not_eof(c);
+    }
+    if (traits_type::eq_int_type(sink->sputc(traits_type::to_char_type(c)),
+                                 traits_type::eof())) {
+      return traits_type::eof();
     }
+    ++count;
+    return c;
   }
-}
+
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    auto written = sink->sputn(s, n);
+    count += written;
+    return written;
+  }
+
+  int sync() override { return sink->pubsync(); }
+
+private:
+  std::streambuf *sink;
+};
+
+// Stand-in database name of the templates, cut out of the generated script.
+const std::string db_slot{"\x01sqlr-db\x01"};
+
+} // namespace
 
 std::string replicate_sql(const std::string &db_name,
                           const jsonio::json &tables, const jsonio::json &users,
                           bool report, bool dry_run) {
-  std::string bad_prefix{"_sql_"};
-  std::string drop_prefix{"_drop_"};
-  for (std::map<std::string, std::size_t> table_ids;
-       const auto &table : tables.get_array()) {
-    sanitize(table["name"].get_string(), "'`");
-    if (table["name"].get_string().rfind(bad_prefix, 0) == 0) {
-      throw std::runtime_error("Publish MySQL: Table Bad Prefix");
-    }
-    sanitize(table["id"].get_string(), "'`");
-    if (++table_ids[table["id"].get_string()] > 1) {
-      throw std::runtime_error("Publish MySQL: Repeated Table Id");
-    }
-    for (std::map<std::string, std::size_t> column_ids;
-         const auto &column : table["columns"].get_array()) {
-      sanitize(column["name"].get_string(), "'`");
-      if (column["name"].get_string().rfind(bad_prefix, 0) == 0) {
-        throw std::runtime_error("Publish MySQL: Column Bad Prefix");
-      }
-      sanitize(column["type"].get_string(), "'`");
-      sanitize(column["id"].get_string(), "'`");
-      if (column["id"].get_string().empty()) {
-        throw std::runtime_error("Publish MySQL: Column No Id");
-      }
-      if (auto default_value = column.at("default"); default_value) {
-        sanitize(default_value->get_string(), "'`");
-      }
-      if (++column_ids[column["id"].get_string()] > 1) {
-        throw std::runtime_error("Publish MySQL: Repeated Column Id");
-      }
-    }
-    if (auto keys = table.at("keys"); keys) {
-      std::map<std::string, std::size_t> index_names;
-      for (const auto &key : keys->get_array()) {
-        if (key["columns"].get_array().size() == 0) {
-          throw std::runtime_error("Publish MySQL: No Key Column");
-        }
-        for (const auto &clm : key["columns"].get_array()) {
-          sanitize(clm.get_string(), "'`");
-        }
-        sanitize(key["name"].get_string(), "'`");
-        if (++index_names[key["name"].get_string()] > 1) {
-          throw std::runtime_error("Publish MySQL: Repeated Key Name");
-        }
-        if (key["type"].get_string() == "primary key" &&
-            key["name"].get_string() != "PRIMARY") {
-          throw std::runtime_error("Publish MySQL: Invalid Primary Key Name");
-        }
-      }
-    }
-    if (auto foreign_keys = table.at("foreign-keys"); foreign_keys) {
-      for (const auto &foreign_key : foreign_keys->get_array()) {
-        sanitize(foreign_key["delete"].get_string(), "'`");
-        sanitize(foreign_key["update"].get_string(), "'`");
-        sanitize(foreign_key["table"].get_string(), "'`");
-        if (foreign_key["columns"].get_array().size() == 0) {
-          throw std::runtime_error("Publish MySQL: No ForeignKey Column");
-        }
-        for (const auto &clm : foreign_key["columns"].get_array()) {
-          sanitize(clm.get_string(), "'`");
-        }
-        if (foreign_key["keys"].get_array().size() == 0) {
-          throw std::runtime_error("Publish MySQL: No ForeignKey Key");
-        }
-        for (const auto &clm : foreign_key["keys"].get_array()) {
-          sanitize(clm.get_string(), "'`");
-        }
-      }
-    }
-    if (auto views = table.at("views"); views) {
-      for (const auto &view : views->get_array()) {
-        sanitize(view["name"].get_string(), "'`");
-        for (const auto &clm : view["columns"].get_array()) {
-          sanitize(clm.get_string(), "'`");
-        }
-        for (const auto &joint : view["joints"].get_array()) {
-          if (const auto &type = joint["type"].get_string();
-              type != "inner" && type != "left outer" &&
-              type != "right outer") {
-            throw std::runtime_error("Publish MySQL: Bad Join Type");
-          }
-          sanitize(joint["table"].get_string(), "'`");
-          sanitize(joint["as"].get_string(), "'`");
-          for (const auto &on : joint["ons"].get_array()) {
-            sanitize(on["base"]["table"].get_string(), "'`");
-            sanitize(on["base"]["column"].get_string(), "'`");
-            sanitize(on["foreign"].get_string(), "'`");
-          }
-          for (const auto &clm : joint["columns"].get_array()) {
-            sanitize(clm["name"].get_string(), "'`");
-            sanitize(clm["as"].get_string(), "'`");
-          }
-        }
-      }
+  replicate_options options;
+  options.report = report;
+  options.dry_run = dry_run;
+  return replicate_sql(db_name, tables, users, options);
+}
+
+std::string replicate_sql(const std::string &db_name,
+                          const jsonio::json &tables, const jsonio::json &users,
+                          const replicate_options &options) {
+  std::ostringstream out;
+  replicate_sql(out, db_name, compile_schema(tables), users, options);
+  return out.str();
+}
+
+void replicate_sql(std::ostream &out, const std::string &db_name,
+                   const jsonio::json &tables, const jsonio::json &users,
+                   const replicate_options &options) {
+  replicate_sql(out, db_name, compile_schema(tables), users, options);
+}
+
+sql_template replicate_template(const schema &tables,
+                                const jsonio::json &users,
+                                const replicate_options &options) {
+  std::ostringstream out;
+  replicate_sql(out, db_slot, tables, users, options);
+  auto generated = out.view();
+  sql_template script;
+  script.text.reserve(generated.size());
+  for (std::size_t begin = 0;;) {
+    auto end = generated.find(db_slot, begin);
+    script.text += generated.substr(begin, end - begin);
+    if (end == std::string_view::npos) {
+      break;
     }
+    script.slots.push_back(script.text.size());
+    begin = end + db_slot.size();
+  }
+  return script;
+}
+
+void check_database_name(const std::string &db_name) {
+  if (db_name.find_first_of("'`\x01") != std::string::npos) {
+    throw std::runtime_error("Publish MySQL: Bad Database Name");
+  }
+}
+
+void write_sql(std::ostream &out, const sql_template &script,
+               const std::string &db_name) {
+  check_database_name(db_name);
+  std::size_t begin = 0;
+  for (auto slot : script.slots) {
+    out.write(script.text.data() + begin, slot - begin);
+    out << db_name;
+    begin = slot;
+  }
+  out.write(script.text.data() + begin, script.text.size() - begin);
+}
+
+void replicate_sql(std::ostream &out, const std::vector<std::string> &db_names,
+                   const schema &tables, const jsonio::json &users,
+                   const replicate_options &options) {
+  // Nothing is written for any database when a name is bad
+  for (const auto &db_name : db_names) {
+    check_database_name(db_name);
+  }
+  auto script = replicate_template(tables, users, options);
+  for (const auto &db_name : db_names) {
+    write_sql(out, script, db_name);
+  }
+}
+
+void replicate_sql(std::ostream &sink, const std::string &db_name,
+                   const schema &tables, const jsonio::json &users,
+                   const replicate_options &options) {
+  if (!options.algorithm.empty()) {
+    algorithm_rank(options.algorithm);
+  }
+  auto warnings = schema_warnings(tables, options.foreign_key_indexes,
+                                  options.redundant_keys);
+  if (options.foreign_key_indexes == "add") {
+    auto indexed = tables;
+    index_foreign_keys(indexed);
+    auto indexed_options = options;
+    indexed_options.foreign_key_indexes.clear();
+    replicate_sql(sink, db_name, indexed, users, indexed_options);
+    return;
+  }
+  // The bytes written are counted for the stats
+  counting_buffer counter{sink.rdbuf()};
+  std::ostream out{&counter};
+  using clock = std::chrono::steady_clock;
+  auto started = clock::now();
+  auto phase_started = started;
+  std::size_t phase_bytes = 0;
+  if (options.stats) {
+    *options.stats = {};
   }
 
+  // A dry run doesn't create the database the copies of the snapshot live in,
+  // so it reads INFORMATION_SCHEMA directly
+  auto snapshot = options.snapshot && !options.dry_run;
   std::string exec;
-  if (report) {
+  if (options.report) {
     exec += R"(
 select @qry as '';
+set @sql_skipped = @sql_skipped + (left(@qry, 6) = 'SET @r');
+set @sql_executed = @sql_executed + (left(@qry, 6) != 'SET @r');
 )";
   }
-  if (!dry_run) {
+  if (!options.dry_run) {
     exec += R"(
 prepare stmt from @qry;
 execute stmt;
 deallocate prepare stmt;
 )";
+    if (snapshot) {
+      exec += R"(set @sql_dirty = @sql_dirty or left(@qry, 6) != 'SET @r';
+)";
+    }
+  }
+
+  // Source of the schema lookups, the snapshot copy or the live view
+  auto information = [&](const char *name, bool alias = true) {
+    if (!snapshot) {
+      return std::string{"`INFORMATION_SCHEMA`.`"} + name + '`';
+    }
+    for (const auto &info : information_tables) {
+      if (strcmp(info.name, name) == 0) {
+        return '`' + db_name + "`.`" + info.copy + '`' +
+               (alias ? std::string{" as `"} + name + '`' : "");
+      }
+    }
+    throw std::logic_error(name);
+  };
+
+  // Reload the snapshot rows of the table named by the SQL expression, or of
+  // the whole database, if a change was applied since the last reload
+  auto sync = [&](std::initializer_list<const char *> names,
+                  const std::string &table = "") {
+    std::string sync_sql;
+    if (!snapshot) {
+      return sync_sql;
+    }
+    for (const auto &info : information_tables) {
+      if (std::find_if(names.begin(), names.end(), [&](auto name) {
+            return strcmp(info.name, name) == 0;
+          }) == names.end()) {
+        continue;
+      }
+      std::string scope = table.empty() ? "" : " and `TABLE_NAME` = " + table;
+      sync_sql += R"(
+delete from `)" + db_name +
+                  "`.`" + info.copy + R"(` where @sql_dirty)" + scope + R"(;
+insert into `)" + db_name +
+                  "`.`" + info.copy + "` (" + info.columns + ")\nselect " +
+                  info.columns + R"(
+    from `INFORMATION_SCHEMA`.`)" +
+                  info.name + R"(`
+    where @sql_dirty and `)" +
+                  info.schema + "` = '" + db_name + "'" + scope + ";";
+    }
+    sync_sql += R"(
+set @sql_dirty = false;
+)";
+    return sync_sql;
+  };
+
+  // Online DDL policy of the table, empty to leave it to the server
+  auto table_algorithm = [&](const schema_table &table) {
+    return table.algorithm.empty() ? options.algorithm : table.algorithm;
+  };
+  // Large tables are rebuilt through a shadow copy, except in a dry run
+  auto shadow = options.shadow_bytes != 0 && !options.dry_run;
+  if (shadow && options.shadow_chunk_rows == 0) {
+    throw std::runtime_error("Publish MySQL: Bad Chunk Size");
   }
+  // A dry run may target a database it doesn't create, so it repeats the
+  // checks instead of installing procedures
+  auto procedures = options.procedures && !options.dry_run;
+  auto online_ddl = std::any_of(
+      tables.tables.begin(), tables.tables.end(),
+      [&](const auto &table) { return !table_algorithm(table).empty(); });
+
+  // Append the cheapest algorithm the changes collected in @sub_query allow,
+  // capped by the policy. A capped algorithm makes the server refuse the ALTER
+  // instead of silently blocking writes. New tables are empty and need none.
+  auto algorithm_clause = [&](const schema_table &table,
+                              const std::string &algorithm) {
+    auto algorithm_sql =
+        R"(
+set @algorithm = if (instr(@new_tables, '{)" +
+        table.name + R"(}') > 0, null,
+    elt(least(@alter_cost, )" +
+        std::to_string(algorithm_rank(algorithm)) + R"() + 1,
+        'ALGORITHM=INSTANT', 'ALGORITHM=INPLACE, LOCK=NONE', 'ALGORITHM=COPY')
+);
+set @sub_query = if (@sub_query = '' or isnull(@algorithm), @sub_query,
+    concat(@sub_query, @algorithm, ', ')
+);
+)";
+    if (options.report) {
+      algorithm_sql += R"(
+select concat('Table ")" +
+                       table.name + R"(" uses ',
+    ifnull(@algorithm, 'the default algorithm'),
+    if (@alter_cost > )" +
+                       std::to_string(algorithm_rank(algorithm)) +
+                       R"(, ', more than the policy allows.', '.')) as ''
+from dual where @sub_query != '';
+)";
+    }
+    return algorithm_sql;
+  };
+
+  // Bring the partitions of the table in line by their own ALTER TABLE
+  // statements: partition maintenance can't be combined with other changes.
+  // A different method or expression repartitions the whole table, while
+  // range and list partitions are dropped, added at the end or reorganized
+  // from the first one that differs, and hash partitions are added or
+  // coalesced, all without rebuilding the other partitions.
+  auto partition = [&](const schema_table &table, const std::string &changed) {
+    const auto &partitioning = *table.partitioning;
+    auto target = "`" + db_name + "`.`" + table.name + '`';
+    auto skip = options.fingerprints ? "@table_unchanged or " : "";
+    // Same text as partition_text() of the server's names
+    auto normalized = [](const std::string &column) {
+      return "lower(replace(replace(replace(replace(" + column +
+             ", '\\'', ''), '\"', ''), '`', ''), ' ', ''))";
+    };
+    auto ok =
+        R"('SET @r = \'Partitions of ")" + table.name + R"(" are ok.\';')";
+    std::string sql = R"(
+set @part_method = null;
+set @part_expression = null;
+set @part_count = 0;
+)";
+    if (partitioning.type == "NONE") {
+      return sql + R"(select max(`PARTITION_METHOD`) into @part_method
+    from `INFORMATION_SCHEMA`.`PARTITIONS`
+    where `TABLE_SCHEMA` = ')" +
+             db_name + "' and `TABLE_NAME` = '" + table.name + R"(' and
+        `PARTITION_NAME` is not null)" +
+             changed + R"(;
+set @qry = if ()" + skip +
+             R"(isnull(@part_method), )" + ok + R"(,
+    'ALTER TABLE )" + target +
+             R"( REMOVE PARTITIONING;');
+)" + exec;
+    }
+    std::string names, bounds, desired, definitions, lengths, offsets = "1";
+    for (const auto &part : partitioning.partitions) {
+      names += '{' + part.name + '}';
+      bounds += '{' + partition_text(part.values) + '}';
+      desired += '{' + part.name + ':' + partition_text(part.values) + '}';
+      definitions += (definitions.empty() ? "" : ", ") + part.definition;
+      lengths += (lengths.empty() ? "(" : " +\n    (") +
+                 std::string{"left(@part_kept, "} +
+                 std::to_string(desired.size()) + ") = left(@part_desired, " +
+                 std::to_string(desired.size()) + "))";
+      offsets += ", " + std::to_string(definitions.size() + 3);
+    }
+    // Every hash partition is kept, and so is a partition renamed by the
+    // definition, with the bound or values of a defined one, to be
+    // reorganized with its rows instead of dropped
+    auto kept = names.empty()
+                    ? std::string{"true"}
+                    : "instr('" + names +
+                          "', concat('{', `PARTITION_NAME`, '}')) > 0 or\n"
+                          "        instr('" +
+                          bounds + "', concat('{', " +
+                          normalized("`PARTITION_DESCRIPTION`") +
+                          ", '}')) > 0";
+    sql += R"(set @part_drops = null;
+set @part_kept = '';
+set @part_kept_names = '';
+select
+    max(`PARTITION_METHOD`),
+    max()" + normalized("ifnull(`PARTITION_EXPRESSION`, '')") + R"(),
+    group_concat(if ()" +
+           kept + R"(, null,
+        concat('`', `PARTITION_NAME`, '`'))
+        ORDER BY `PARTITION_ORDINAL_POSITION` SEPARATOR ', '),
+    ifnull(group_concat(if ()" +
+           kept + R"(,
+        concat('{', `PARTITION_NAME`, ':', )" +
+           normalized("`PARTITION_DESCRIPTION`") + R"(, '}'), null)
+        ORDER BY `PARTITION_ORDINAL_POSITION` SEPARATOR ''), ''),
+    ifnull(group_concat(if ()" +
+           kept + R"(,
+        concat('`', `PARTITION_NAME`, '`'), null)
+        ORDER BY `PARTITION_ORDINAL_POSITION` SEPARATOR ', '), ''),
+    count(distinct if ()" +
+           kept + R"(, `PARTITION_NAME`, null))
+into
+    @part_method, @part_expression, @part_drops, @part_kept,
+    @part_kept_names, @part_count
+from `INFORMATION_SCHEMA`.`PARTITIONS`
+where `TABLE_SCHEMA` = ')" +
+           db_name + "' and `TABLE_NAME` = '" + table.name + R"(' and
+    `PARTITION_NAME` is not null)" +
+           changed + R"(;
+set @part_rebuild = not ()" + skip + R"(@part_method <=> ')" +
+           partitioning.type + R"(' and
+    @part_expression = ')" +
+           partition_text(partitioning.expression) + R"(' and @part_count > 0);
+set @qry = if (@part_rebuild,
+    'ALTER TABLE )" +
+           target + ' ' + partitioning.definition + R"(;', )" + ok + R"();
+)" + exec;
+    if (partitioning.partitions.empty()) {
+      // Hash and key partitions are only counted
+      auto count = std::to_string(partitioning.count);
+      return sql + R"(
+set @qry = if ()" + skip + "@part_rebuild or @part_count = " + count +
+             ", " + ok + R"(,
+    concat('ALTER TABLE )" +
+             target + R"( ', if (@part_count < )" + count + R"(,
+        concat('ADD PARTITION PARTITIONS ', )" +
+             count + R"( - @part_count),
+        concat('COALESCE PARTITION ', @part_count - )" +
+             count + R"()), ';'));
+)" + exec;
+    }
+    // The kept partitions match the definition up to @part_same of them
+    return sql + R"(
+set @qry = if ()" + skip + R"(@part_rebuild or isnull(@part_drops), )" + ok +
+           R"(,
+    concat('ALTER TABLE )" + target +
+           R"( DROP PARTITION ', @part_drops, ';'));
+)" + exec + R"(
+set @part_desired = ')" +
+           desired + R"(';
+set @part_same = )" + lengths + R"(;
+set @part_rest = substr(')" +
+           definitions + R"(', elt(@part_same + 1, )" + offsets + R"());
+set @qry = if ()" + skip + R"(@part_rebuild or @part_rest = '', )" + ok +
+           R"(,
+    concat('ALTER TABLE )" + target +
+           R"( ', if (@part_same = @part_count, 'ADD PARTITION (',
+        concat('REORGANIZE PARTITION ', substring_index(@part_kept_names,
+            ', ', @part_same - @part_count), ' INTO (')), @part_rest, ');'));
+)" + exec;
+  };
 
   // Start Transaction
-  std::string sql = "";
+  std::string sql = warnings;
+  if (options.report) {
+    sql += R"(
+set @sql_started = now(6);
+set @sql_phase_started = @sql_started;
+set @sql_phases = json_array();
+set @sql_slowest = json_array();
+set @sql_executed = 0;
+set @sql_skipped = 0;
+set @sql_rebuilds = 0;
+)";
+  }
+
+  // Append the execution of @qry and hand the pending statements to the sink
+  auto execute = [&]() {
+    sql += exec;
+    out << sql;
+    sql.clear();
+  };
+
+  // Close the phase: hand its statements to the sink, time it on the server
+  // in report mode and count its generation in the stats
+  auto end_phase = [&](const char *name) {
+    if (options.report) {
+      sql += R"(
+set @sql_phases = json_array_append(@sql_phases, '$', json_object(
+    'phase', ')" + std::string{name} +
+             R"(',
+    'seconds', timestampdiff(microsecond, @sql_phase_started, now(6)) / 1e6));
+set @sql_phase_started = now(6);
+)";
+    }
+    out << sql;
+    sql.clear();
+    if (options.stats) {
+      auto now = clock::now();
+      options.stats->phases.push_back(
+          {name, counter.count - phase_bytes,
+           std::chrono::duration<double>(now - phase_started).count()});
+      phase_started = now;
+      phase_bytes = counter.count;
+    }
+  };
+
+  // Generate the fragment of every item by the phase and hand them to the
+  // sink in order. With several threads, the fragments of a window of items
+  // are generated in parallel and then written in order.
+  auto each = [&](const auto &all, const auto &phase) {
+    out << sql;
+    sql.clear();
+    if (options.threads <= 1) {
+      for (const auto &item : all) {
+        phase(item, sql);
+        out << sql;
+        sql.clear();
+      }
+      return;
+    }
+    std::vector<std::string> fragments;
+    for (std::size_t begin = 0; begin < all.size();
+         begin += fragments.size()) {
+      fragments.assign(std::min(all.size() - begin, options.threads * 16), {});
+      std::atomic<std::size_t> next{0};
+      std::exception_ptr error;
+      std::mutex error_mutex;
+      auto work = [&]() {
+        for (std::size_t i; (i = next++) < fragments.size();) {
+          try {
+            phase(all[begin + i], fragments[i]);
+          } catch (...) {
+            std::lock_guard lock{error_mutex};
+            if (!error) {
+              error = std::current_exception();
+            }
+          }
+        }
+      };
+      std::vector<std::thread> workers;
+      for (std::size_t i = 1; i < options.threads; ++i) {
+        workers.emplace_back(work);
+      }
+      work();
+      for (auto &worker : workers) {
+        worker.join();
+      }
+      if (error) {
+        std::rethrow_exception(error);
+      }
+      for (const auto &fragment : fragments) {
+        out << fragment;
+      }
+    }
+  };
+  auto each_table = [&](const auto &phase) { each(tables.tables, phase); };
 
   // Create database
   sql += R"(
@@ -143,336 +588,1058 @@ set @qry = if (isnull(@old_db),
          db_name + R"(" exists.\';'
 );
 )";
-  sql += exec;
+  execute();
+  end_phase("Create database");
 
-  // Create tables with prefix
-  sql += R"(
-set @all_tables = '';
-set @all_views = '';
+  // SQL expressions describing a column, literals in the unrolled checks and
+  // parameters in the procedures
+  struct column_sql {
+    std::string table, id, name, type, definition, default_changed, null,
+        auto_increment;
+  };
+
+  // Look the column up and append its ADD or CHANGE to @sub_query. Unless the
+  // column order is ignored, the existing columns are fed to a patience sort
+  // of their positions and the order clauses are left as {order:id} and
+  // {move:id} marks for the planning that follows the last column.
+  auto column_check = [&](const column_sql &column) {
+    auto mark = [&](const char *kind) {
+      return options.ignore_column_order
+                 ? std::string{"''"}
+                 : "concat('{" + std::string{kind} + ":', " + column.id +
+                       ", '}')";
+    };
+    auto check_sql = R"(
+set @old_column = null;
+set @old_type = null;
+set @old_default = null;
+set @old_null = null;
+set @old_auto = null;
+set @old_position = null;
+select `COLUMN_NAME`, `COLUMN_TYPE`, `COLUMN_DEFAULT`, `IS_NULLABLE`,
+    `EXTRA` like '%auto_increment%' as AUTO, `ORDINAL_POSITION`
+    into @old_column, @old_type, @old_default, @old_null, @old_auto,
+        @old_position
+    from )" + information("COLUMNS") +
+                     R"(
+    where `COLUMN_COMMENT` = )" +
+                     column.id + R"( and
+        `COLUMNS`.`TABLE_NAME` = )" +
+                     column.table + R"( and
+        `COLUMNS`.`TABLE_SCHEMA` = ')" +
+                     db_name + "'" +
+                     (options.fingerprints ? " and not @table_unchanged" : "") +
+                     ";\n";
+    if (!options.ignore_column_order) {
+      check_sql += R"(set @lis_k = 0;
+select count(*) into @lis_k
+    from json_table(@lis_tails,
+        '$[*]' columns (`position` int unsigned path '$')) as `tails`
+    where `position` < @old_position;
+set @lis_existing = if (isnull(@old_position), @lis_existing,
+    concat(@lis_existing, '{', )" +
+                   column.id + R"(, '}'));
+set @lis_parents = if (isnull(@old_position), @lis_parents,
+    json_set(@lis_parents, concat('$."', )" +
+                   column.id + R"(, '"'), if (@lis_k = 0, '',
+        json_unquote(json_extract(@lis_ids, concat('$[', @lis_k - 1, ']'))))));
+set @lis_tails = if (isnull(@old_position), @lis_tails,
+    json_set(@lis_tails, concat('$[', @lis_k, ']'), @old_position));
+set @lis_ids = if (isnull(@old_position), @lis_ids,
+    json_set(@lis_ids, concat('$[', @lis_k, ']'), )" +
+                   column.id + R"());
 )";
-  std::map<std::string, std::string> engines;
-  for (const auto &table : tables.get_array()) {
-    if (auto engine = table.get_object().find("engine");
-        engine != table.get_object().end()) {
-      engines[table["name"].get_string()] = engine->second.get_string();
-    } else {
-      engines[table["name"].get_string()] = "InnoDB";
     }
-    sql += R"(
-set @all_tables = concat(@all_tables, '{)" +
-           table["id"].get_string() + R"(}');
-set @old_table = null;
-select `TABLE_NAME` into @old_table
-    from `INFORMATION_SCHEMA`.`TABLES`
-    where `TABLE_COMMENT` = ')" +
-           table["id"].get_string() + R"(' and
-        `TABLE_SCHEMA` = ')" +
-           db_name + R"(';
-set @qry = if (isnull(@old_table),
-    'CREATE TABLE `)" +
-           db_name + R"(`.`)" + bad_prefix + table["name"].get_string() +
-           R"(` (`)" + bad_prefix + R"(` int UNSIGNED NOT NULL) ENGINE=)" +
-           engines[table["name"].get_string()] +
-           R"( DEFAULT CHARSET=utf8 COMMENT \')" + table["id"].get_string() +
-           R"(\';'
+    check_sql += R"(set @sub_query = concat(@sub_query, if (isnull(@old_column),
+    concat('ADD ', )" + column.definition +
+                 ", " + mark("order") + R"(, ', ')
 ,
-    'SET @r = \'Table ")" +
-           table["name"].get_string() + R"(" exist.\';'
-);
-)";
-    if (auto views = table.at("views"); views) {
-      for (const auto &view : views->get_array()) {
-        sql += R"(
-set @all_views = concat(@all_views, '{)" +
-               view["name"].get_string() + R"(}');
+    if (@old_column != )" +
+                 column.name + " or @old_type != " + column.type + R"( or
+        )" + column.default_changed +
+                 " or\n        @old_null != " + column.null +
+                 " or @old_auto != " + column.auto_increment + R"(,
+        concat('CHANGE `', @old_column, '` ', )" +
+                 column.definition + ", " + mark("order") + R"(, ', ')
+    ,
+        )" + mark("move") + R"(
+    )
+));
 )";
-      }
-    }
-    sql += exec;
-  }
+    return check_sql;
+  };
 
-  // Remove extra views
-  sql += R"(
-set @sub_query = null;
-select group_concat(concat('`)" +
-         db_name + R"(`.`', `TABLE_NAME`, '`') SEPARATOR ', ')
-    into @sub_query
-    from `INFORMATION_SCHEMA`.`TABLES`
-    where `TABLE_SCHEMA` = ')" +
-         db_name +
-         R"(' and `TABLE_TYPE` = 'VIEW' and
-        instr(@all_views, concat('{', `TABLE_NAME`, '}')) = 0;
-set @qry = if (isnull(@sub_query),
-    'SET @r = \'No extra view.\';'
-,
-    concat('DROP VIEW ', @sub_query, ';')
-);
+  // Renames and defaults are instant, new columns too unless auto_increment,
+  // nullability rebuilds in place, type and auto_increment changes copy
+  auto column_rank = [](const column_sql &column) {
+    return "if (isnull(@old_column), if (" + column.auto_increment +
+           ", 2, 0),\n    if (@old_type != " + column.type +
+           " or @old_auto != " + column.auto_increment +
+           ", 2,\n        if (@old_null != " + column.null + ", 1, 0)))";
+  };
+
+  // Keep the existing columns of the longest run already in order and move
+  // the others after their predecessor. New columns followed only by new
+  // columns are appended without a position.
+  auto column_order = [&](const column_sql &column, const std::string &order) {
+    return R"(set @lis_moved = instr(@lis_kept, concat('{', )" + column.id +
+           R"(, '}')) = 0 and
+    (instr(@lis_existing, concat('{', )" +
+           column.id + R"(, '}')) > 0 or not @lis_appended);
+set @lis_appended = @lis_appended and
+    instr(@lis_existing, concat('{', )" +
+           column.id + R"(, '}')) = 0;
+set @sub_query = replace(replace(@sub_query,
+    concat('{order:', )" +
+           column.id + R"(, '}'), if (@lis_moved, concat(' ', )" + order +
+           R"(), '')),
+    concat('{move:', )" +
+           column.id + R"(, '}'), if (@lis_moved,
+        concat('CHANGE `', )" +
+           column.name + ", '` ', " + column.definition + ", ' ', " + order +
+           R"(, ', '), ''));
 )";
-  sql += exec;
+  };
+  // A moved existing column rebuilds the table in place
+  auto order_rank = [](const column_sql &column) {
+    return "if (@lis_moved and\n    instr(@lis_existing, concat('{', " +
+           column.id + ", '}')) > 0, 1, 0)";
+  };
 
-  // Mark extra tables
-  sql += R"(
-set @sub_query = null;
-select group_concat(concat('`)" +
-         db_name + R"(`.`', `TABLE_NAME`, '` to `)" + db_name + R"(`.`)" +
-         bad_prefix + drop_prefix +
-         R"(', `TABLE_NAME`, '`') SEPARATOR ', ')
-    into @sub_query
-    from `INFORMATION_SCHEMA`.`TABLES`
-    where `TABLE_NAME` not like ')" +
-         bad_prefix + drop_prefix + R"(%' and `TABLE_SCHEMA` = ')" + db_name +
-         R"(' and `TABLE_TYPE` = 'BASE TABLE' and
-        instr(@all_tables, concat('{', `TABLE_COMMENT`, '}')) = 0;
-set @qry = if (isnull(@sub_query),
-    'SET @r = \'No extra table.\';'
-,
-    concat('RENAME TABLE ', @sub_query, ';')
-);
+  // Ids of the longest run of existing columns in order, back from its last
+  // column through the parents recorded by the patience sort
+  std::string kept_columns = R"(
+set @lis_kept = '';
+with recursive `kept` (`id`) as (
+    select json_unquote(json_extract(@lis_ids, '$[last]'))
+    union all
+    select json_unquote(json_extract(@lis_parents, concat('$."', `id`, '"')))
+    from `kept` where `id` != ''
+)
+select ifnull(group_concat('{', `id`, '}' SEPARATOR ''), '') into @lis_kept
+    from `kept`;
+set @lis_appended = true;
 )";
-  sql += exec;
 
-  // Apply table names
-  sql += R"(
-set @ren_tables_prefix = '';
-set @ren_tables_final = '';
+  // Lookups of a table matching its stored fingerprint find nothing, so the
+  // server skips them without reading the schema
+  std::string changed =
+      options.fingerprints ? " and not @table_unchanged" : "";
+
+  // SQL expressions describing a table, literals in the unrolled statements
+  // and parameters in the procedures
+  struct table_sql {
+    std::string id, name, engine;
+  };
+  auto table_literals = [](const schema_table &table) {
+    return table_sql{'\'' + table.id + '\'', '\'' + table.name + '\'',
+                     '\'' + table.engine + '\''};
+  };
+
+  // Record the table and look up the table holding its id and the one
+  // holding its name
+  auto table_lookup = [&](const table_sql &table) {
+    return R"(
+set @all_tables = concat(@all_tables, '{', )" +
+           table.id + R"(, '}');
+set @old_table = null;
+select `TABLE_NAME` into @old_table
+    from )" + information("TABLES") + R"(
+    where `TABLE_COMMENT` = )" +
+           table.id + R"( and
+        `TABLE_SCHEMA` = ')" +
+           db_name + R"(';
+set @name_taken = null;
+select `TABLE_NAME` into @name_taken
+    from )" + information("TABLES") + R"(
+    where `TABLE_NAME` = )" +
+           table.name + R"( and
+        `TABLE_SCHEMA` = ')" +
+           db_name + R"(';
 )";
-  for (const auto &table : tables.get_array()) {
-    sql += R"(
+  };
+
+  // Collect the renames of the table, through the prefix and directly
+  auto table_rename = [&](const table_sql &table) {
+    return R"(
 set @old_table = null;
 select `TABLE_NAME` into @old_table
-    from `INFORMATION_SCHEMA`.`TABLES`
-    where `TABLE_COMMENT` = ')" +
-           table["id"].get_string() + R"(' and
+    from )" + information("TABLES") + R"(
+    where `TABLE_COMMENT` = )" +
+           table.id + R"( and
         `TABLE_SCHEMA` = ')" +
            db_name + R"(';
-set @ren_tables_prefix = if (@old_table != ')" +
-           table["name"].get_string() + R"(' && instr(@old_table, ')" +
-           bad_prefix + R"(') != 1,
+set @ren_tables_prefix = if (@old_table != )" +
+           table.name + R"( && instr(@old_table, ')" + bad_prefix +
+           R"(') != 1,
     concat(@ren_tables_prefix, '`)" +
            db_name + R"(`.`', @old_table, '` to `)" + db_name + R"(`.`)" +
-           bad_prefix + table["name"].get_string() + R"(`, ')
+           bad_prefix + R"(', )" + table.name + R"(, '`, ')
 ,
     @ren_tables_prefix
 );
-set @ren_tables_final = if (@old_table != ')" +
-           table["name"].get_string() +
-           R"(',
+set @ren_tables_final = if (@old_table != )" +
+           table.name + R"(,
     concat(@ren_tables_final, '`)" +
-           db_name + R"(`.`)" + bad_prefix + table["name"].get_string() +
-           R"(` to `)" + db_name + R"(`.`)" + table["name"].get_string() +
-           R"(`, ')
+           db_name + R"(`.`)" + bad_prefix + R"(', )" + table.name +
+           R"(, '` to `)" + db_name + R"(`.`', )" + table.name + R"(, '`, ')
 ,
     @ren_tables_final
 );
+set @ren_tables_direct = if (@old_table != )" +
+           table.name + R"(,
+    concat(@ren_tables_direct, '`)" +
+           db_name + R"(`.`', @old_table, '` to `)" + db_name + R"(`.`', )" +
+           table.name + R"(, '`, ')
+,
+    @ren_tables_direct
+);
+set @ren_collision = @ren_collision or @old_table != )" +
+           table.name + R"( and exists (
+    select `TABLE_NAME` from )" +
+           information("TABLES") + R"(
+    where `TABLE_NAME` = )" +
+           table.name + R"( and `TABLE_SCHEMA` = ')" + db_name + R"(');
 )";
-  }
-  sql += R"(
-set @qry = if (@ren_tables_final != '',
-    if (@ren_tables_prefix != '', concat ('RENAME TABLE ',
-        substr(@ren_tables_prefix, 1, length(@ren_tables_prefix) - 2), ';')
-    ,
-        'SET @r = \'All tables have prefix.\';'
-    ),
-    'SET @r = \'No table needs prefix.\';'
+  };
+
+  // Drop the foreign keys of the table missing from @all_foreign_keys
+  auto extra_foreign_keys = [&](const table_sql &table) {
+    return R"(
+set @drop_query = null;
+select group_concat(distinct
+    concat('DROP FOREIGN KEY `', `CONSTRAINT_NAME`, '`') SEPARATOR ', ')
+into @drop_query
+from )" + information("KEY_COLUMN_USAGE") +
+           R"(
+where
+    `REFERENCED_TABLE_NAME` is not null and
+    `TABLE_SCHEMA` = ')" +
+           db_name + R"(' and
+    `TABLE_NAME` = )" +
+           table.name + R"( and
+    instr(@all_foreign_keys, `CONSTRAINT_NAME`) = 0)" +
+           changed + R"(;
+set @sub_query = if (isnull(@drop_query), @sub_query,
+    concat(@sub_query, @drop_query, ', ')
 );
 )";
-  sql += exec;
-  sql += R"(
-set @qry = if (@ren_tables_final != '', concat ('RENAME TABLE ',
-    substr(@ren_tables_final, 1, length(@ren_tables_final) - 2), ';')
-,
-    'SET @r = \'No table rename needed.\';');
+  };
+
+  // Drop the columns of the table missing from @all_columns
+  auto extra_columns = [&](const table_sql &table) {
+    return R"(
+set @drop_query = null;
+select group_concat(concat('DROP COLUMN `', `COLUMN_NAME`, '`')
+    SEPARATOR ', ') into @drop_query
+    from )" + information("COLUMNS") +
+           R"(
+    where
+        `COLUMNS`.`TABLE_NAME` = )" +
+           table.name + R"( and
+        `COLUMNS`.`TABLE_SCHEMA` = ')" +
+           db_name + R"(' and
+        instr(@all_columns, concat('{', `COLUMN_COMMENT`, '}')) = 0)" +
+           changed + R"(;
+set @sub_query = if (isnull(@drop_query), @sub_query,
+    concat(@sub_query, @drop_query, ', ')
+);
 )";
-  sql += exec;
+  };
 
-  // Apply table engine
-  for (const auto &table : tables.get_array()) {
-    sql += R"(
+  // Drop the keys of the table missing from @all_keys, or hide them and drop
+  // the ones hidden long enough
+  auto extra_keys = [&](const table_sql &table) {
+    auto hidden = "concat('{', " + table.id + ", ':', `INDEX_NAME`, '}')";
+    std::string keys_sql = !options.staged_index_drops ? R"(
+set @drop_query = null;
+select group_concat(distinct
+    concat('DROP INDEX `', `INDEX_NAME`, '`') SEPARATOR ', ')
+into @drop_query
+from )" : R"(
+set @drop_query = null;
+set @hide_query = null;
+set @extra_keys = null;
+select
+    group_concat(distinct if (`INDEX_NAME` = 'PRIMARY' or
+        `IS_VISIBLE` = 'NO' and instr(@index_drops, )" + hidden + R"() > 0,
+        concat('DROP INDEX `', `INDEX_NAME`, '`'), null) SEPARATOR ', '),
+    group_concat(distinct if (`INDEX_NAME` != 'PRIMARY' and
+        `IS_VISIBLE` = 'YES',
+        concat('ALTER INDEX `', `INDEX_NAME`, '` INVISIBLE'), null)
+        SEPARATOR ', '),
+    group_concat(distinct if (`INDEX_NAME` = 'PRIMARY', null,
+        concat('(\'', )" + table.id + R"(, '\', \'', `INDEX_NAME`, '\')'))
+        SEPARATOR ', ')
+into @drop_query, @hide_query, @extra_keys
+from )";
+    keys_sql += information("STATISTICS") +
+                R"(
+join )" + information("KEY_COLUMN_USAGE") +
+                R"(
+on
+    `STATISTICS`.`INDEX_SCHEMA` =
+    `KEY_COLUMN_USAGE`.`CONSTRAINT_SCHEMA` and
+    `STATISTICS`.`TABLE_NAME` =
+    `KEY_COLUMN_USAGE`.`TABLE_NAME` and
+    `STATISTICS`.`INDEX_NAME` =
+    `KEY_COLUMN_USAGE`.`CONSTRAINT_NAME`
+where
+    `KEY_COLUMN_USAGE`.`REFERENCED_TABLE_NAME` is null and
+    `STATISTICS`.`INDEX_SCHEMA` = ')" +
+                db_name + R"(' and
+    `STATISTICS`.`TABLE_NAME` = )" +
+                table.name + R"( and
+    instr(@all_keys, `INDEX_NAME`) = 0)" +
+                changed + ";\n";
+    if (options.staged_index_drops) {
+      keys_sql += "set @drop_query = nullif(concat_ws(', ', @drop_query, "
+                  "@hide_query), '');\n";
+    }
+    keys_sql += R"(set @sub_query = if (isnull(@drop_query), @sub_query,
+    concat(@sub_query, @drop_query, ', ')
+);
+)";
+    return keys_sql;
+  };
+  // Dropping a primary key without adding one copies the table
+  std::string extra_keys_rank = "if (isnull(@drop_query), 0,\n    if (instr("
+                                "@drop_query, '`PRIMARY`') > 0, 2, 1))";
+
+  // Change the engine of the table if it differs
+  auto table_engine = [&](const table_sql &table) {
+    return R"(
 set @old_engine = null;
 select `ENGINE` into @old_engine
+    from )" + information("TABLES") +
+           R"(
+    where `TABLE_NAME` = )" +
+           table.name + R"( and
+        `TABLE_SCHEMA` = ')" +
+           db_name + "'" + changed + R"(;
+set @sub_query = if (@old_engine != )" +
+           table.engine + R"(,
+    concat(@sub_query, 'ENGINE=', )" +
+           table.engine + R"(, ', ')
+,
+    @sub_query
+);
+)";
+  };
+  auto engine_rank = [](const table_sql &table) {
+    return "if (@old_engine != " + table.engine + ", 2, 0)";
+  };
+
+  // Run the changes collected in @sub_query as one ALTER TABLE, or report the
+  // message saying the table is in line
+  auto alter_table = [&](const table_sql &table, const std::string &ok) {
+    return R"(
+set @qry = if (@sub_query != '',
+    concat ('ALTER TABLE `)" +
+           db_name + R"(`.`', )" + table.name +
+           R"(, '` ', substr(@sub_query, 1, length(@sub_query) - 2), ';')
+,
+    concat('SET @r = \'', )" +
+           ok + R"(, '\';')
+);
+)" + exec;
+  };
+
+  // Add the foreign key by its name and definition unless it exists
+  auto add_constraint = [&](const std::string &name,
+                            const std::string &definition) {
+    return R"(
+set @old_constraint = null;
+select `CONSTRAINT_NAME` into @old_constraint
+from )" + information("KEY_COLUMN_USAGE") +
+           R"(
+where
+    `REFERENCED_TABLE_NAME` is not null and
+    `TABLE_SCHEMA` = ')" +
+           db_name + R"(' and
+    `CONSTRAINT_NAME` = )" +
+           name + R"(
+group by `CONSTRAINT_NAME`;
+set @sub_query = if (isnull(@old_constraint),
+    concat(@sub_query, 'ADD CONSTRAINT `', )" +
+           name + R"(, '` ', )" + definition + R"(, ', ')
+,
+    @sub_query
+);
+)";
+  };
+
+  // Replace a stored procedure of the run, between DELIMITER // and ;
+  auto procedure = [&](const std::string &name, const std::string &parameters,
+                       const std::string &body) {
+    auto qualified = '`' + db_name + "`.`" + bad_prefix + name + '`';
+    sql += "\nDROP PROCEDURE IF EXISTS " + qualified +
+           "//\nCREATE PROCEDURE " + qualified + "(" + parameters +
+           ")\nBEGIN" + (body.empty() ? "\n" : body) + "END//\n";
+  };
+
+  // Install shadow procedure
+  if (shadow) {
+    auto shadow_table = bad_prefix + "_shadow_";
+    auto stale_table = bad_prefix + stale_prefix;
+    sql += "\nDELIMITER //\n";
+    procedure("shadow", R"(
+    p_table varchar(64), p_id varchar(255), p_chunk int unsigned
+)",
+              R"(
+set @shadow = null;
+select `TABLE_NAME` into @shadow
+    from `INFORMATION_SCHEMA`.`TABLES`
+    where `TABLE_SCHEMA` = ')" +
+                  db_name + R"(' and `TABLE_NAME` = p_table and
+        @sub_query != '' and @alter_cost = 2 and `DATA_LENGTH` >= )" +
+                  std::to_string(options.shadow_bytes) + R"( and
+        exists (select `INDEX_NAME` from `INFORMATION_SCHEMA`.`STATISTICS`
+            where `TABLE_SCHEMA` = ')" +
+                  db_name + R"(' and `TABLE_NAME` = p_table and
+                `INDEX_NAME` = 'PRIMARY') and
+        not exists (select `TABLE_NAME`
+            from `INFORMATION_SCHEMA`.`KEY_COLUMN_USAGE`
+            where `REFERENCED_TABLE_SCHEMA` = ')" +
+                  db_name + R"(' and
+                `REFERENCED_TABLE_NAME` = p_table);
+if @shadow is not null then
+)" + (options.report ? R"(select concat('Table "', p_table,
+    '" is rebuilt through a shadow copy.') as '';
+)"
+                                     : "") +
+                  R"(set @qry = concat('DROP TABLE IF EXISTS `)" + db_name +
+                  "`.`" + shadow_table + R"(', p_table, '`;');)" + exec +
+                  R"(set @qry = concat('CREATE TABLE `)" + db_name + "`.`" +
+                  shadow_table + R"(', p_table, '` LIKE `)" + db_name +
+                  R"(`.`', p_table, '`;');)" + exec +
+                  R"(set @qry = concat('ALTER TABLE `)" + db_name + "`.`" +
+                  shadow_table + R"(', p_table, '` ',
+    regexp_replace(@sub_query, 'DROP FOREIGN KEY `[^`]*`, ', ''),
+    'COMMENT=\'\';');)" +
+                  exec + R"(
+select
+    group_concat(concat('`', `COLUMN_NAME`, '`')
+        ORDER BY `SEQ_IN_INDEX` SEPARATOR ', '),
+    group_concat(concat('quote(`', `COLUMN_NAME`, '`)')
+        ORDER BY `SEQ_IN_INDEX` SEPARATOR ', '),
+    group_concat(concat('`', `COLUMN_NAME`, '` DESC')
+        ORDER BY `SEQ_IN_INDEX` SEPARATOR ', ')
+into @shadow_key, @shadow_quoted, @shadow_descending
+from `INFORMATION_SCHEMA`.`STATISTICS`
+where `TABLE_SCHEMA` = ')" +
+                  db_name + R"(' and `TABLE_NAME` = p_table and
+    `INDEX_NAME` = 'PRIMARY';
+select group_concat(concat('quote(`', `COLUMN_NAME`, '`)')
+    ORDER BY `ORDINAL_POSITION` SEPARATOR ', ')
+into @shadow_columns
+from `INFORMATION_SCHEMA`.`COLUMNS`
+where `TABLE_SCHEMA` = ')" +
+                  db_name + R"(' and `TABLE_NAME` = p_table;
+set @shadow_sum_query = concat('SELECT concat(count(*), \':\', ',
+    'ifnull(bit_xor(cast(conv(left(md5(concat_ws(\'#\', ', @shadow_columns,
+    ')), 16), 16, 10) AS unsigned)), 0)) INTO @shadow_sum FROM `)" +
+                  db_name + R"(`.`');
+set @shadow_query = concat(@shadow_sum_query, p_table, '`');
+prepare stmt from @shadow_query;
+execute stmt;
+deallocate prepare stmt;
+set @shadow_start = @shadow_sum;
+set @shadow_last = null;
+repeat
+  set @shadow_next = null;
+  set @shadow_query = concat('SELECT concat_ws(\', \', ', @shadow_quoted,
+      ') INTO @shadow_next FROM (SELECT ', @shadow_key, ' FROM `)" +
+                  db_name + R"(`.`', p_table, '`',
+      if (isnull(@shadow_last), '',
+          concat(' WHERE (', @shadow_key, ') > (', @shadow_last, ')')),
+      ' ORDER BY ', @shadow_key, ' LIMIT ', p_chunk, ') AS `chunk` ORDER BY ',
+      @shadow_descending, ' LIMIT 1');
+  prepare stmt from @shadow_query;
+  execute stmt;
+  deallocate prepare stmt;
+  if @shadow_next is not null then
+    set @qry = concat('INSERT INTO `)" +
+                  db_name + "`.`" + shadow_table +
+                  R"(', p_table, '` (', @shadow_to,
+        ') SELECT ', @shadow_from, ' FROM `)" +
+                  db_name + R"(`.`', p_table, '` WHERE ',
+        if (isnull(@shadow_last), '',
+            concat('(', @shadow_key, ') > (', @shadow_last, ') AND ')),
+        '(', @shadow_key, ') <= (', @shadow_next, ');');)" +
+                  exec + R"(
+    set @shadow_last = @shadow_next;
+  end if;
+until @shadow_next is null end repeat;
+set @qry = concat('ALTER TABLE `)" +
+                  db_name + "`.`" + shadow_table +
+                  R"(', p_table, '` COMMENT=\'', p_id, '\';');)" + exec +
+                  R"(set @shadow_query = concat(
+    'SELECT count(*) INTO @shadow_rows FROM `)" +
+                  db_name + "`.`" + shadow_table + R"(', p_table, '`');
+prepare stmt from @shadow_query;
+execute stmt;
+deallocate prepare stmt;
+set @shadow_query = concat(@shadow_sum_query, p_table, '`');
+prepare stmt from @shadow_query;
+execute stmt;
+deallocate prepare stmt;
+if @shadow_sum != @shadow_start or
+    @shadow_rows != substring_index(@shadow_start, ':', 1) then
+  signal sqlstate '45000'
+      set message_text = 'Publish MySQL: Rows Changed During Shadow Copy';
+end if;
+set @qry = concat('RENAME TABLE `)" + db_name +
+                  R"(`.`', p_table, '` TO `)" + db_name + "`.`" +
+                  stale_table + R"(', p_table, '`, `)" + db_name + "`.`" +
+                  shadow_table + R"(', p_table, '` TO `)" + db_name +
+                  R"(`.`', p_table, '`;');)" + exec +
+                  R"(set @shadow_query = concat(@shadow_sum_query, ')" +
+                  stale_table + R"(', p_table, '`');
+prepare stmt from @shadow_query;
+execute stmt;
+deallocate prepare stmt;
+if @shadow_sum != @shadow_start then
+  set @qry = concat('ALTER TABLE `)" +
+                  db_name + "`.`" + stale_table +
+                  R"(', p_table, '` COMMENT=\'\';');)" + exec +
+                  R"(  signal sqlstate '45000'
+      set message_text = 'Publish MySQL: Rows Changed During Shadow Swap';
+end if;
+set @qry = concat('DROP TABLE `)" + db_name + "`.`" +
+                  stale_table + R"(', p_table, '`;');)" + exec +
+                  R"(set @shadow_tables =
+    concat(@shadow_tables, '{', p_table, '}');
+set @sub_query = '';
+end if;
+)");
+    sql += "\nDELIMITER ;\n";
+    // Room for the column lists of the widest table
+    std::size_t columns = 0;
+    for (const auto &table : tables.tables) {
+      columns = std::max(columns, table.columns.size());
+    }
+    sql += R"(
+set session group_concat_max_len =
+    greatest(@@group_concat_max_len, )" +
+           std::to_string(columns * 80) + R"();
+set @shadow_tables = '';
+)";
+    out << sql;
+    sql.clear();
+  }
+
+  // Install procedures
+  if (procedures) {
+    sql += "\nDELIMITER //\n";
+    procedure("run", "", exec);
+    procedure("foreign_key", R"(
+    p_table varchar(64), p_name varchar(64), p_column_ids text,
+    p_referenced_table varchar(64), p_quoted_keys text,
+    p_update varchar(64), p_delete varchar(64)
+)",
+              R"(
+set @all_foreign_keys = concat(@all_foreign_keys, p_name, ' ');
+set @old_constraint = null;
+set @old_key_def = null;
+set @old_referenced_table = null;
+set @old_f_key_def = null;
+set @old_update_rule = null;
+set @old_delete_rule = null;
+select
+    `fk`.`CONSTRAINT_NAME`,
+    `fk`.`key_def`,
+    `fk`.`REFERENCED_TABLE_NAME`,
+    `fk`.`f_key_def`,
+    `rk`.`UPDATE_RULE`,
+    `rk`.`DELETE_RULE`
+into
+    @old_constraint,
+    @old_key_def,
+    @old_referenced_table,
+    @old_f_key_def,
+    @old_update_rule,
+    @old_delete_rule
+from )" + information("REFERENTIAL_CONSTRAINTS", false) +
+                  R"( as `rk`
+join (
+select
+    `CONSTRAINT_SCHEMA`,
+    `CONSTRAINT_NAME`,
+    `KEY_COLUMN_USAGE`.`TABLE_NAME`,
+    group_concat(`COLUMNS`.`COLUMN_COMMENT`
+        ORDER BY `KEY_COLUMN_USAGE`.`ORDINAL_POSITION`
+        SEPARATOR ',') as `key_def`,
+    `REFERENCED_TABLE_NAME`,
+    group_concat(concat('`', `REFERENCED_COLUMN_NAME`, '`')
+        ORDER BY `POSITION_IN_UNIQUE_CONSTRAINT`
+        SEPARATOR ', ') as `f_key_def`
+from )" + information("KEY_COLUMN_USAGE") +
+                  R"(
+join )" + information("COLUMNS") +
+                  R"(
+on
+    `KEY_COLUMN_USAGE`.`TABLE_SCHEMA` = `COLUMNS`.`TABLE_SCHEMA` and
+    `KEY_COLUMN_USAGE`.`TABLE_NAME` = `COLUMNS`.`TABLE_NAME` and
+    `KEY_COLUMN_USAGE`.`COLUMN_NAME` = `COLUMNS`.`COLUMN_NAME`
+where
+    `REFERENCED_TABLE_NAME` is not null and
+    `CONSTRAINT_SCHEMA` = ')" +
+                  db_name + R"(' and
+    `KEY_COLUMN_USAGE`.`TABLE_NAME` = p_table and
+    `CONSTRAINT_NAME` = p_name)" +
+                  changed + R"(
+group by `CONSTRAINT_NAME`, `KEY_COLUMN_USAGE`.`TABLE_NAME`,
+    `REFERENCED_TABLE_NAME`) as `fk`
+using (
+    `CONSTRAINT_SCHEMA`,
+    `CONSTRAINT_NAME`,
+    `TABLE_NAME`,
+    `REFERENCED_TABLE_NAME`);
+set @old_ok =
+    @old_key_def = p_column_ids and
+    @old_referenced_table = p_referenced_table and
+    @old_f_key_def = p_quoted_keys and
+    @old_update_rule = p_update and
+    @old_delete_rule = p_delete;
+set @sub_query = if (@old_ok or isnull(@old_constraint), @sub_query,
+    concat(@sub_query, 'DROP FOREIGN KEY `', p_name, '`, ')
+);
+set @alter_cost = greatest(@alter_cost,
+    if (@old_ok or isnull(@old_constraint), 0, 1));
+)");
+    // The definition is passed without the comment holding the id
+    column_sql parameters{"p_table", "p_id", "p_name", "p_type",
+                          "concat(p_definition, ' COMMENT \\'', p_id, '\\'')",
+                          "if (p_has_default, @old_default IS NULL or "
+                          "@old_default != p_default, @old_default IS NOT "
+                          "NULL)",
+                          "p_null", "p_auto"};
+    auto column_body = column_check(parameters) +
+                       "set @alter_cost = greatest(@alter_cost,\n    " +
+                       column_rank(parameters) + ");\n";
+    if (!options.ignore_column_order) {
+      // Keep the name and definition for the moves
+      column_body += R"(set @lis_columns = json_set(@lis_columns,
+    concat('$."', p_id, '"'),
+    json_object('name', p_name, 'definition', )" +
+                     parameters.definition + R"());
+)";
+    }
+    procedure("column", R"(
+    p_table varchar(64), p_id varchar(255), p_name varchar(64),
+    p_type text, p_definition text, p_has_default bool, p_default text,
+    p_null varchar(3), p_auto bool
+)",
+              column_body);
+    if (!options.ignore_column_order) {
+      auto ordered = parameters;
+      ordered.name = R"(json_unquote(json_extract(@lis_columns,
+        concat('$."', p_id, '".name'))))";
+      ordered.definition = R"(json_unquote(json_extract(@lis_columns,
+        concat('$."', p_id, '".definition'))))";
+      procedure("column_order", "p_id varchar(255), p_order text",
+                '\n' + column_order(ordered, "p_order") +
+                    "set @alter_cost = greatest(@alter_cost, " +
+                    order_rank(ordered) + ");\n");
+    }
+    procedure("key", R"(
+    p_table varchar(64), p_name varchar(64), p_type varchar(64),
+    p_column_ids text, p_quoted_columns text, p_visible varchar(3),
+    p_rank int unsigned
+)",
+              R"(
+set @all_keys = concat(@all_keys, p_name, ' ');
+set @old_index = null;
+set @old_key_def = null;
+set @old_visible = null;
+select
+    `STATISTICS`.`INDEX_NAME`,
+    group_concat(`COLUMNS`.`COLUMN_COMMENT`
+        ORDER BY `SEQ_IN_INDEX` SEPARATOR ','),
+    max(`STATISTICS`.`IS_VISIBLE`)
+into
+    @old_index,
+    @old_key_def,
+    @old_visible
+from )" + information("STATISTICS") +
+                  R"(
+join )" + information("COLUMNS") +
+                  R"(
+on
+    `STATISTICS`.`TABLE_SCHEMA` = `COLUMNS`.`TABLE_SCHEMA` and
+    `STATISTICS`.`TABLE_NAME` = `COLUMNS`.`TABLE_NAME` and
+    `STATISTICS`.`COLUMN_NAME` = `COLUMNS`.`COLUMN_NAME`
+where
+    `STATISTICS`.`TABLE_SCHEMA` = ')" +
+                  db_name + R"(' and
+    `STATISTICS`.`TABLE_NAME` = p_table and
+    `STATISTICS`.`INDEX_NAME` = p_name)" +
+                  changed + R"(
+group by `STATISTICS`.`INDEX_NAME`;
+set @old_ok = @old_key_def = p_column_ids;
+set @drop_query = if (@old_ok or isnull(@old_index), '',
+    concat('DROP INDEX `', p_name, '`, '));
+set @sub_query = concat(@sub_query, @drop_query);
+set @sub_query = if (@drop_query != '' or isnull(@old_index),
+    concat(@sub_query, 'ADD ', p_type, ' `', p_name, '` (', p_quoted_columns,
+        ')', if (p_visible = 'NO', ' INVISIBLE', ''), ', ')
+, @sub_query);
+set @sub_query = concat(@sub_query, if (@drop_query = '' and
+    @old_visible != p_visible, concat('ALTER INDEX `', p_name, '` ',
+        if (p_visible = 'NO', 'INVISIBLE', 'VISIBLE'), ', '), ''));
+set @alter_cost = greatest(@alter_cost,
+    if (@drop_query != '' or isnull(@old_index), p_rank,
+        @old_visible != p_visible));
+)");
+    // The glue around the objects of a table
+    table_sql table{"p_id", "p_table", "p_engine"};
+    procedure("table", "p_id varchar(255), p_table varchar(64)",
+              table_lookup(table));
+    procedure("rename", "p_id varchar(255), p_table varchar(64)",
+              table_rename(table));
+    procedure("extra_foreign_keys", "p_table varchar(64)",
+              extra_foreign_keys(table) +
+                  "set @alter_cost = greatest(@alter_cost, "
+                  "if (isnull(@drop_query), 0, 1));\n");
+    if (!options.ignore_column_order) {
+      procedure("kept_columns", "", kept_columns);
+    }
+    procedure("extra_columns", "p_table varchar(64)",
+              extra_columns(table) +
+                  "set @alter_cost = greatest(@alter_cost, "
+                  "if (isnull(@drop_query), 0, 1));\n");
+    procedure("extra_keys", "p_id varchar(255), p_table varchar(64)",
+              extra_keys(table) + "set @alter_cost = greatest(@alter_cost, " +
+                  extra_keys_rank + ");\n");
+    procedure("engine", "p_table varchar(64), p_engine varchar(64)",
+              table_engine(table) + "set @alter_cost = greatest(@alter_cost, " +
+                  engine_rank(table) + ");\n");
+    procedure("alter", "p_table varchar(64), p_ok text",
+              alter_table(table, "p_ok"));
+    procedure("constraint", "p_name varchar(64), p_definition text",
+              add_constraint("p_name", "p_definition"));
+    sql += "\nDELIMITER ;\n";
+    out << sql;
+    sql.clear();
+    exec = "\ncall `" + db_name + "`.`" + bad_prefix + "run`();\n";
+  }
+  if (shadow || procedures) {
+    end_phase("Install procedures");
+  }
+  // Call of an installed procedure with the given SQL arguments
+  auto call = [&](const char *name, const std::string &arguments) {
+    return "\ncall `" + db_name + "`.`" + bad_prefix + name + "`(" +
+           arguments + ");\n";
+  };
+
+  // Take snapshot
+  if (snapshot) {
+    for (const auto &info : information_tables) {
+      sql += R"(
+drop temporary table if exists `)" +
+             db_name + "`.`" + info.copy + R"(`;
+create temporary table `)" +
+             db_name + "`.`" + info.copy + "` (" + info.definition + R"(
+);
+insert into `)" + db_name +
+             "`.`" + info.copy + "` (" + info.columns + ")\nselect " +
+             info.columns + R"(
+    from `INFORMATION_SCHEMA`.`)" +
+             info.name + R"(`
+    where `)" + info.schema +
+             "` = '" + db_name + R"(';
+)";
+    }
+    sql += R"(
+set @sql_dirty = false;
+)";
+    end_phase("Take snapshot");
+  }
+
+  // Load fingerprints
+  if (options.fingerprints) {
+    sql += R"(
+set @qry = 'CREATE TABLE IF NOT EXISTS `)" +
+           db_name + "`.`" + fingerprints_table + R"(` (
+    `id` varchar(255) NOT NULL PRIMARY KEY,
+    `fingerprint` char(16) NOT NULL
+) ENGINE=InnoDB DEFAULT CHARSET=utf8;';
+)";
+    execute();
+    // Room for every {id:fingerprint} pair of the tables
+    std::size_t fingerprints_length = 0;
+    for (const auto &table : tables.tables) {
+      fingerprints_length += table.id.size() + table.fingerprint.size() + 3;
+    }
+    sql += R"(
+set @fingerprints = '';
+set @old_fingerprints = null;
+select `TABLE_NAME` into @old_fingerprints
     from `INFORMATION_SCHEMA`.`TABLES`
     where `TABLE_NAME` = ')" +
-           table["name"].get_string() + R"(' and
+           fingerprints_table + R"(' and
         `TABLE_SCHEMA` = ')" +
            db_name + R"(';
-set @qry = if (@old_engine != ')" +
-           engines[table["name"].get_string()] + R"(',
-    'ALTER TABLE `)" +
-           db_name + R"(`.`)" + table["name"].get_string() + R"(` ENGINE=)" +
-           engines[table["name"].get_string()] + R"(;'
+set session group_concat_max_len =
+    greatest(@@group_concat_max_len, )" +
+           std::to_string(fingerprints_length) + R"();
+set @fingerprints_query = if (isnull(@old_fingerprints),
+    'SET @r = \'No fingerprints.\';'
 ,
-    'SET @r = \'Engine of ")" +
-           table["name"].get_string() + R"(" is ok.\';'
+    'SELECT ifnull(group_concat(
+        concat(\'{\', `id`, \':\', `fingerprint`, \'}\') SEPARATOR \'\'),
+        \'\') INTO @fingerprints FROM `)" +
+           db_name + "`.`" + fingerprints_table + R"(`;'
 );
+prepare stmt from @fingerprints_query;
+execute stmt;
+deallocate prepare stmt;
 )";
-    sql += exec;
+    end_phase("Load fingerprints");
   }
 
-  for (const auto &table : tables.get_array()) {
-
-    // Create columns with prefix
+  // Load hidden indexes, as {id:index} pairs, and those hidden long enough
+  // to be dropped
+  if (options.staged_index_drops) {
     sql += R"(
-set @all_columns = '';
-set @sub_query = '';
+set @qry = 'CREATE TABLE IF NOT EXISTS `)" +
+           db_name + "`.`" + index_drops_table + R"(` (
+    `id` varchar(255) NOT NULL,
+    `index_name` varchar(64) NOT NULL,
+    `hidden` datetime NOT NULL DEFAULT CURRENT_TIMESTAMP,
+    PRIMARY KEY (`id`, `index_name`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8;';
 )";
-    for (const auto &column : table["columns"].get_array()) {
-      auto default_value = column.at("default");
-      sql += R"(
-set @all_columns = concat(@all_columns, '{)" +
-             column["id"].get_string() +
-             R"(}');
-set @old_column = null;
-select `COLUMN_NAME` into @old_column
-    from `INFORMATION_SCHEMA`.`COLUMNS`
-    where `COLUMN_COMMENT` = ')" +
-             column["id"].get_string() + R"(' and
-        `COLUMNS`.`TABLE_NAME` = ')" +
-             table["name"].get_string() + R"(' and
-        `COLUMNS`.`TABLE_SCHEMA` = ')" +
-             db_name + R"(';
-set @sub_query = if (isnull(@old_column),
-    concat(@sub_query, 'ADD `)" +
-             bad_prefix + column["name"].get_string() + R"(` )" +
-             column["type"].get_string() +
-             (default_value ? " DEFAULT " + default_value->get_string() : "") +
-             R"( COMMENT \')" + column["id"].get_string() +
-             R"(\', ')
+    execute();
+    sql += R"(
+set @index_hidden = '';
+set @index_drops = '';
+set @old_index_drops = null;
+select `TABLE_NAME` into @old_index_drops
+    from `INFORMATION_SCHEMA`.`TABLES`
+    where `TABLE_NAME` = ')" +
+           index_drops_table + R"(' and
+        `TABLE_SCHEMA` = ')" +
+           db_name + R"(';
+set session group_concat_max_len =
+    greatest(@@group_concat_max_len, 16777216);
+set @index_drops_query = if (isnull(@old_index_drops),
+    'SET @r = \'No hidden index.\';'
 ,
-    @sub_query
+    'SELECT
+        ifnull(group_concat(concat(\'{\', `id`, \':\', `index_name`, \'}\')
+            SEPARATOR \'\'), \'\'),
+        ifnull(group_concat(if(`hidden` <= now() - INTERVAL )" +
+           std::to_string(options.index_drop_grace_days) + R"( DAY,
+            concat(\'{\', `id`, \':\', `index_name`, \'}\'), null)
+            SEPARATOR \'\'), \'\')
+    INTO @index_hidden, @index_drops FROM `)" +
+           db_name + "`.`" + index_drops_table + R"(`;'
 );
+prepare stmt from @index_drops_query;
+execute stmt;
+deallocate prepare stmt;
+)";
+    end_phase("Load hidden indexes");
+  }
+
+  // Create tables, with the prefix while another table holds the name
+  sql += R"(
+set @all_tables = '';
+set @all_views = '';
+)";
+  if (online_ddl || shadow) {
+    sql += R"(set @new_tables = '';
 )";
+  }
+  each_table([&](const schema_table &table, std::string &sql) {
+    // New tables get their columns and keys at once and skip the ALTER
+    std::string elements;
+    for (const auto &column : table.columns) {
+      elements += (elements.empty() ? "\n    " : ",\n    ") +
+                  column.definition + R"( COMMENT \')" + column.id + R"(\')";
     }
-    sql += R"(
-set @qry = if (@sub_query != '',
-    concat('ALTER TABLE `)" +
-           db_name + R"(`.`)" + table["name"].get_string() +
-           R"(` ', substr(@sub_query, 1, length(@sub_query) - 2), ';')
+    for (const auto &key : table.keys) {
+      elements +=
+          (elements.empty() ? "\n    " : ",\n    ") + key_definition(key);
+    }
+    if (elements.empty()) {
+      elements = "\n    `" + bad_prefix + "` int UNSIGNED NOT NULL";
+    }
+    auto literal_table = table_literals(table);
+    sql += procedures ? call("table", literal_table.id + ", " +
+                                          literal_table.name)
+                      : table_lookup(literal_table);
+    sql += R"(set @qry = if (isnull(@old_table),
+    concat('CREATE TABLE `)" +
+           db_name + R"(`.`', if (isnull(@name_taken), '', ')" + bad_prefix +
+           R"('), ')" + table.name + R"(` ()" + elements + R"(
+) ENGINE=)" + table.engine +
+           R"( DEFAULT CHARSET=utf8 COMMENT \')" + table.id + R"(\')" +
+           (table.partitioning && table.partitioning->type != "NONE"
+                ? ' ' + table.partitioning->definition
+                : "") +
+           R"(;')
 ,
-    'SET @r = \'No new column in ")" +
-           table["name"].get_string() +
-           R"(" is needed.\';'
+    'SET @r = \'Table ")" +
+           table.name + R"(" exist.\';'
+);
+)";
+    if (online_ddl || shadow) {
+      sql += R"(set @new_tables = concat(@new_tables,
+    if (isnull(@old_table), '{)" +
+             table.name + R"(}', '')
+);
+)";
+    }
+    if (options.fingerprints) {
+      // A table created again has to be checked whatever it was
+      sql += R"(set @fingerprints = if (isnull(@old_table),
+    replace(@fingerprints, '{)" +
+             table.id + ':' + table.fingerprint + R"(}', ''),
+    @fingerprints
 );
 )";
+    }
+    for (const auto &view : table.views) {
+      sql += R"(
+set @all_views = concat(@all_views, '{)" +
+             view.name + R"(}');
+)";
+    }
     sql += exec;
+  });
+  end_phase("Create tables");
 
-    // Mark Extra columns
-    sql += R"(
+  // Remove extra views
+  sql += R"(
 set @sub_query = null;
-select group_concat(concat('RENAME COLUMN `', `COLUMN_NAME`, '` to `)" +
-           bad_prefix + drop_prefix + R"(', `COLUMN_NAME`, '`') SEPARATOR ', ')
+select group_concat(concat('`)" +
+         db_name + R"(`.`', `TABLE_NAME`, '`') SEPARATOR ', ')
     into @sub_query
-    from `INFORMATION_SCHEMA`.`COLUMNS`
-    where `COLUMN_NAME` not like ')" +
-           bad_prefix + drop_prefix + R"(%' and `TABLE_SCHEMA` = ')" + db_name +
-           R"(' and `TABLE_NAME` = ')" + table["name"].get_string() + R"(' and
-        instr(@all_columns, concat('{', `COLUMN_COMMENT`, '}')) = 0;
+    from )" + information("TABLES") + R"(
+    where `TABLE_SCHEMA` = ')" +
+         db_name +
+         R"(' and `TABLE_TYPE` = 'VIEW' and
+        instr(@all_views, concat('{', `TABLE_NAME`, '}')) = 0;
 set @qry = if (isnull(@sub_query),
-    'SET @r = \'No extra column in ")" +
-           table["name"].get_string() + R"(".\';'
+    'SET @r = \'No extra view.\';'
 ,
-    concat('ALTER TABLE `)" +
-           db_name + R"(`.`)" + table["name"].get_string() +
-           R"(` ', @sub_query, ';')
+    concat('DROP VIEW ', @sub_query, ';')
 );
 )";
-    sql += exec;
+  execute();
+  end_phase("Remove extra views");
 
-    // Apply column names
-    sql += R"(
-set @ren_columns_prefix = '';
-set @ren_columns_final = '';
-)";
-    for (const auto &column : table["columns"].get_array()) {
-      sql += R"(
-set @old_column = null;
-select `COLUMN_NAME` into @old_column
-    from `INFORMATION_SCHEMA`.`COLUMNS`
-    where `COLUMN_COMMENT` = ')" +
-             column["id"].get_string() + R"(' and
-        `COLUMNS`.`TABLE_NAME` = ')" +
-             table["name"].get_string() + R"(' and
-        `COLUMNS`.`TABLE_SCHEMA` = ')" +
-             db_name + R"(';
-set @ren_columns_prefix = if (@old_column != ')" +
-             column["name"].get_string() + R"(' && instr(@old_column, ')" +
-             bad_prefix + R"(') != 1,
-    concat(@ren_columns_prefix, 'RENAME COLUMN `', @old_column, '` to `)" +
-             bad_prefix + column["name"].get_string() + R"(`, ')
-,
-    @ren_columns_prefix
-);
-set @ren_columns_final = if (@old_column != ')" +
-             column["name"].get_string() + R"(',
-    concat(@ren_columns_final, 'RENAME COLUMN `)" +
-             bad_prefix + column["name"].get_string() + R"(` to `)" +
-             column["name"].get_string() + R"(`, ')
+  // Mark extra tables
+  sql += R"(
+set @sub_query = null;
+select group_concat(concat('`)" +
+         db_name + R"(`.`', `TABLE_NAME`, '` to `)" + db_name + R"(`.`)" +
+         bad_prefix + drop_prefix +
+         R"(', `TABLE_NAME`, '`') SEPARATOR ', ')
+    into @sub_query
+    from )" + information("TABLES") + R"(
+    where `TABLE_NAME` not like ')" +
+         bad_prefix + drop_prefix + R"(%' and `TABLE_SCHEMA` = ')" + db_name +
+         R"(' and `TABLE_TYPE` = 'BASE TABLE' and
+        `TABLE_NAME` not like ')" +
+         bad_prefix + stale_prefix + R"(%' and)" +
+         (options.fingerprints ? "\n        `TABLE_NAME` != '" +
+                                     fingerprints_table + "' and"
+                               : "") +
+         (options.staged_index_drops ? "\n        `TABLE_NAME` != '" +
+                                           index_drops_table + "' and"
+                                     : "") +
+         R"(
+        instr(@all_tables, concat('{', `TABLE_COMMENT`, '}')) = 0;
+set @qry = if (isnull(@sub_query),
+    'SET @r = \'No extra table.\';'
 ,
-    @ren_columns_final
+    concat('RENAME TABLE ', @sub_query, ';')
 );
 )";
-    }
-    sql += R"(
-set @qry = if (@ren_columns_final != '',
-    if (@ren_columns_prefix != '',
-        concat ('ALTER TABLE `)" +
-           db_name + R"(`.`)" + table["name"].get_string() +
-           R"(` ', substr(@ren_columns_prefix, 1,
-        length(@ren_columns_prefix) - 2), ';')
-    ,
-        'SET @r = \'All columns in ")" +
-           table["name"].get_string() +
-           R"(" have prefix.\';'
-    ),
-    'SET @r = \'No column in ")" +
-           table["name"].get_string() +
-           R"(" needs prefix.\';'
-);
+  execute();
+  // The tables created or marked carry columns and keys to reload as well
+  sql += sync({"TABLES", "COLUMNS", "STATISTICS", "KEY_COLUMN_USAGE",
+               "REFERENTIAL_CONSTRAINTS"});
+  end_phase("Mark extra tables");
+
+  // Apply table names, through the prefix only when a name is still taken
+  sql += R"(
+set @ren_tables_prefix = '';
+set @ren_tables_final = '';
+set @ren_tables_direct = '';
+set @ren_collision = false;
 )";
-    sql += exec;
-    sql += R"(
-set @qry = if (@ren_columns_final != '', concat ('ALTER TABLE `)" +
-           db_name + R"(`.`)" + table["name"].get_string() + R"(` ',
-    substr(@ren_columns_final, 1, length(@ren_columns_final) - 2), ';')
+  each_table([&](const schema_table &table, std::string &sql) {
+    auto literal_table = table_literals(table);
+    sql += procedures ? call("rename", literal_table.id + ", " +
+                                           literal_table.name)
+                      : table_rename(literal_table);
+  });
+  sql += R"(
+set @ren_tables = if (@ren_collision,
+    concat(@ren_tables_prefix, @ren_tables_final), @ren_tables_direct);
+set @qry = if (@ren_tables != '', concat ('RENAME TABLE ',
+    substr(@ren_tables, 1, length(@ren_tables) - 2), ';')
 ,
-    'SET @r = \'No column in ")" +
-           table["name"].get_string() +
-           R"(" needs rename.\';');
+    'SET @r = \'No table rename needed.\';');
 )";
-    sql += exec;
-  }
+  execute();
+  sql += sync({"TABLES", "COLUMNS", "STATISTICS", "KEY_COLUMN_USAGE",
+                "REFERENTIAL_CONSTRAINTS"});
+  end_phase("Apply table names");
+
+  // Apply tables
+  each_table([&](const schema_table &table, std::string &sql) {
+    // Raise the cost of the ALTER to the given rank expression
+    auto algorithm = table_algorithm(table);
+    auto ranked = !algorithm.empty() || shadow || options.report;
+    auto cost = [&](const std::string &rank) {
+      return !ranked ? std::string{}
+                     : "set @alter_cost = greatest(@alter_cost, " + rank +
+                           ");\n";
+    };
+    if (options.fingerprints) {
+      sql += R"(
+set @table_unchanged = instr(@fingerprints, '{)" +
+             table.id + ':' + table.fingerprint + R"(}') > 0;
+)";
+      if (options.staged_index_drops) {
+        // Hidden indexes are still to be dropped
+        sql += "set @table_unchanged = @table_unchanged and\n"
+               "    instr(@index_hidden, '{" +
+               table.id + ":') = 0;\n";
+      }
+    }
+
+    if (options.report) {
+      sql += "\nset @sql_table_started = now(6);\n";
+    }
 
-  // Drop wrong foreign keys
-  std::map<std::string,
-           std::map<std::string, std::pair<std::string, std::string>>>
-      fk_flatten_columns;
-  for (const auto &table : tables.get_array()) {
+    // Drop wrong foreign keys
     sql += R"(
+set @sub_query = '';
 set @all_foreign_keys = '';
 )";
-    if (auto foreign_keys = table.at("foreign-keys"); foreign_keys) {
-      for (const auto &key : foreign_keys->get_array()) {
-        std::string key_def;
-        for (const auto &clm : key["columns"].get_array()) {
-          if (!key_def.empty()) {
-            key_def += ", ";
-          }
-          key_def += '`' + clm.get_string() + '`';
-        }
-        std::string f_key_def;
-        for (const auto &f_key : key["keys"].get_array()) {
-          if (!f_key_def.empty()) {
-            f_key_def += ", ";
-          }
-          f_key_def += '`' + f_key.get_string() + '`';
-        }
-        fk_flatten_columns[table["name"].get_string()]
-                          [key["name"].get_string()] = {std::move(key_def),
-                                                        std::move(f_key_def)};
-        sql += R"(
+    if (ranked) {
+      sql += "set @alter_cost = 0;\n";
+    }
+    for (const auto &key : table.foreign_keys) {
+      if (procedures) {
+        sql += call("foreign_key", '\'' + table.name + "', '" + key.name +
+                                       "', '" + key.column_ids + "', '" +
+                                       key.table + "', '" + key.quoted_keys +
+                                       "', '" + key.on_update + "', '" +
+                                       key.on_delete + '\'');
+        continue;
+      }
+      sql += R"(
 set @all_foreign_keys = concat(@all_foreign_keys, ')" +
-               key["name"].get_string() + R"( ');
+             key.name + R"( ');
 set @old_constraint = null;
-set @old_table = null;
 set @old_key_def = null;
 set @old_referenced_table = null;
 set @old_f_key_def = null;
@@ -480,7 +1647,6 @@ set @old_update_rule = null;
 set @old_delete_rule = null;
 select
     `fk`.`CONSTRAINT_NAME`,
-    `fk`.`TABLE_NAME`,
     `fk`.`key_def`,
     `fk`.`REFERENCED_TABLE_NAME`,
     `fk`.`f_key_def`,
@@ -488,309 +1654,320 @@ select
     `rk`.`DELETE_RULE`
 into
     @old_constraint,
-    @old_table,
     @old_key_def,
     @old_referenced_table,
     @old_f_key_def,
     @old_update_rule,
     @old_delete_rule
-from `INFORMATION_SCHEMA`.`REFERENTIAL_CONSTRAINTS` as `rk`
+from )" + information("REFERENTIAL_CONSTRAINTS", false) +
+             R"( as `rk`
 join (
 select
-    `CONSTRAINT_NAME`,
     `CONSTRAINT_SCHEMA`,
-    `TABLE_NAME`,
-    group_concat(concat('`', `COLUMN_NAME`, '`')
-        ORDER BY `ORDINAL_POSITION`
-        SEPARATOR ', ') as `key_def`,
+    `CONSTRAINT_NAME`,
+    `KEY_COLUMN_USAGE`.`TABLE_NAME`,
+    group_concat(`COLUMNS`.`COLUMN_COMMENT`
+        ORDER BY `KEY_COLUMN_USAGE`.`ORDINAL_POSITION`
+        SEPARATOR ',') as `key_def`,
     `REFERENCED_TABLE_NAME`,
     group_concat(concat('`', `REFERENCED_COLUMN_NAME`, '`')
         ORDER BY `POSITION_IN_UNIQUE_CONSTRAINT`
         SEPARATOR ', ') as `f_key_def`
-from `INFORMATION_SCHEMA`.`KEY_COLUMN_USAGE`
+from )" + information("KEY_COLUMN_USAGE") +
+             R"(
+join )" + information("COLUMNS") +
+             R"(
+on
+    `KEY_COLUMN_USAGE`.`TABLE_SCHEMA` = `COLUMNS`.`TABLE_SCHEMA` and
+    `KEY_COLUMN_USAGE`.`TABLE_NAME` = `COLUMNS`.`TABLE_NAME` and
+    `KEY_COLUMN_USAGE`.`COLUMN_NAME` = `COLUMNS`.`COLUMN_NAME`
 where
     `REFERENCED_TABLE_NAME` is not null and
     `CONSTRAINT_SCHEMA` = ')" +
-               db_name + R"(' and
+             db_name + R"(' and
+    `KEY_COLUMN_USAGE`.`TABLE_NAME` = ')" +
+             table.name + R"(' and
     `CONSTRAINT_NAME` = ')" +
-               key["name"].get_string() + R"('
-group by `CONSTRAINT_NAME`, `TABLE_NAME`, `REFERENCED_TABLE_NAME`) as `fk`
+             key.name + "'" + changed + R"(
+group by `CONSTRAINT_NAME`, `KEY_COLUMN_USAGE`.`TABLE_NAME`,
+    `REFERENCED_TABLE_NAME`) as `fk`
 using (
     `CONSTRAINT_SCHEMA`,
     `CONSTRAINT_NAME`,
     `TABLE_NAME`,
     `REFERENCED_TABLE_NAME`);
-set @old_ok = 
-    @old_table = ')" +
-               table["name"].get_string() + R"(' and
+set @old_ok =
     @old_key_def = ')" +
-               fk_flatten_columns[table["name"].get_string()]
-                                 [key["name"].get_string()]
-                                     .first +
-               R"(' and
+             key.column_ids + R"(' and
     @old_referenced_table = ')" +
-               key["table"].get_string() + R"(' and
+             key.table + R"(' and
     @old_f_key_def = ')" +
-               fk_flatten_columns[table["name"].get_string()]
-                                 [key["name"].get_string()]
-                                     .second +
-               R"(' and
+             key.quoted_keys + R"(' and
     @old_update_rule = ')" +
-               key["update"].get_string() + R"(' and
+             key.on_update + R"(' and
     @old_delete_rule = ')" +
-               key["delete"].get_string() + R"(';
-set @qry = if (@old_ok or isnull(@old_constraint),
-    'SET @r = \'Foreign key ")" +
-               key["name"].get_string() +
-               R"(" does not exist.\';'
-,
-    concat('ALTER TABLE `)" +
-               db_name + R"(`.`', @old_table, '` DROP FOREIGN KEY `)" +
-               key["name"].get_string() + R"(`;'));
+             key.on_delete + R"(';
+set @sub_query = if (@old_ok or isnull(@old_constraint), @sub_query,
+    concat(@sub_query, 'DROP FOREIGN KEY `)" +
+             key.name + R"(`, ')
+);
 )";
-        sql += exec;
-      }
+      sql += cost("if (@old_ok or isnull(@old_constraint), 0, 1)");
     }
 
     // Remove extra foreign keys
-    sql += R"(
-set @sub_query = null;
-select group_concat(distinct
-    concat('DROP FOREIGN KEY `', `CONSTRAINT_NAME`, '`') SEPARATOR ', ')
-into @sub_query
-from `INFORMATION_SCHEMA`.`KEY_COLUMN_USAGE`
-where
-    `REFERENCED_TABLE_NAME` is not null and
-    `TABLE_SCHEMA` = ')" +
-           db_name + R"(' and
-    `TABLE_NAME` = ')" +
-           table["name"].get_string() + R"(' and
-    instr(@all_foreign_keys, `CONSTRAINT_NAME`) = 0;
-set @qry = if (isnull(@sub_query),
-    'SET @r = \'No extra foreign keys in ")" +
-           table["name"].get_string() +
-           R"(".\';'
-,
-    concat('ALTER TABLE `)" +
-           db_name + R"(`.`)" + table["name"].get_string() +
-           R"(` ', @sub_query, ';')
-);
-)";
-    sql += exec;
-  }
+    auto literal_table = table_literals(table);
+    if (procedures) {
+      sql += call("extra_foreign_keys", literal_table.name);
+    } else {
+      sql += extra_foreign_keys(literal_table);
+      sql += cost("if (isnull(@drop_query), 0, 1)");
+    }
 
-  for (const auto &table : tables.get_array()) {
-    // Apply column properties
+    // Apply columns
+    std::string all_columns;
+    for (const auto &column : table.columns) {
+      all_columns += '{' + column.id + '}';
+    }
     sql += R"(
-set @sub_query = '';
-set @ordinal_change = false;
-)";
-    std::string order = "FIRST";
-    for (const auto &column : table["columns"].get_array()) {
-      auto ordinal_position{std::to_string(
-          1 + std::distance(&table["columns"].get_array().front(), &column))};
-      auto is_null = false;
-      if (auto column_null = column.at("null");
-          column_null && column_null->get_bool()) {
-        is_null = true;
-      }
-      auto default_value = column.at("default");
-      auto is_auto = false;
-      if (auto column_auto = column.at("auto");
-          column_auto && column_auto->get_bool()) {
-        is_auto = true;
-      };
-      sql +=
-          R"(
-set @old_type = null;
-set @old_default = null;
-set @old_null = null;
-set @old_auto = null;
-set @old_position = null;
-select `COLUMN_TYPE`, `COLUMN_DEFAULT`, `IS_NULLABLE`,
-    `EXTRA` like '%auto_increment%' as AUTO, `ORDINAL_POSITION`
-    into @old_type, @old_default, @old_null, @old_auto, @old_position
-    from `INFORMATION_SCHEMA`.`COLUMNS`
-    where `COLUMN_NAME` = ')" +
-          column["name"].get_string() + R"(' and
-        `COLUMNS`.`TABLE_NAME` = ')" +
-          table["name"].get_string() + R"(' and
-        `COLUMNS`.`TABLE_SCHEMA` = ')" +
-          db_name + R"(';
-set @ordinal_change = if (@old_position != )" +
-          ordinal_position +
-          R"(, true, @ordinal_change);
-set @sub_query = if (@ordinal_change or
-    @old_type != ')" +
-          column["type"].get_string() + R"(')" +
-          (default_value ? R"( or @old_default IS NULL or @old_default != )" +
-                               default_value->get_string()
-                         : "") +
-          R"( or
-    @old_null != ')" +
-          (is_null ? "YES" : "NO") + R"(' or
-    @old_auto != )" +
-          (is_auto ? "true" : "false") + R"(,
-    concat(@sub_query, 'MODIFY `)" +
-          column["name"].get_string() + R"(` )" + column["type"].get_string() +
-          (default_value ? " DEFAULT " + default_value->get_string() : "") +
-          (is_null ? " null" : " not null") +
-          (is_auto ? " auto_increment" : "") + R"( COMMENT \')" +
-          column["id"].get_string() + R"(\' )" + order +
-          R"(, ')
-,
-    @sub_query
-);
+set @all_columns = ')" +
+           all_columns + R"(';
+)";
+    if (!options.ignore_column_order) {
+      sql += R"(set @lis_existing = '';
+set @lis_tails = '[]';
+set @lis_ids = '[]';
+set @lis_parents = '{}';
 )";
-      order = "AFTER `" + column["name"].get_string() + "`";
+      if (procedures) {
+        sql += "set @lis_columns = '{}';\n";
+      }
+    }
+    auto literals = [&](const schema_column &column) {
+      return column_sql{
+          '\'' + table.name + '\'',
+          '\'' + column.id + '\'',
+          '\'' + column.name + '\'',
+          '\'' + column.type + '\'',
+          '\'' + column.definition + R"( COMMENT \')" + column.id + R"(\'')",
+          column.default_value ? "(@old_default IS NULL or @old_default != " +
+                                     *column.default_value + ')'
+                               : "@old_default IS NOT NULL",
+          column.null ? "'YES'" : "'NO'",
+          column.auto_increment ? "true" : "false"};
+    };
+    for (const auto &column : table.columns) {
+      if (procedures) {
+        sql += call("column", '\'' + table.name + "', '" + column.id + "', '" +
+                                  column.name + "', '" + column.type + "', '" +
+                                  column.definition + "', " +
+                                  (column.default_value
+                                       ? "true, " + *column.default_value
+                                       : "false, null") +
+                                  ", '" + (column.null ? "YES" : "NO") +
+                                  "', " +
+                                  (column.auto_increment ? "true" : "false"));
+        continue;
+      }
+      sql += column_check(literals(column));
+      sql += cost(column_rank(literals(column)));
+    }
+    if (!options.ignore_column_order) {
+      // Plan the moves from the last column, to know which new columns are
+      // only followed by new columns
+      sql += procedures ? call("kept_columns", "") : kept_columns;
+      for (auto column = table.columns.rbegin();
+           column != table.columns.rend(); ++column) {
+        auto order = column + 1 == table.columns.rend()
+                         ? std::string{"FIRST"}
+                         : "AFTER `" + (column + 1)->name + '`';
+        if (procedures) {
+          sql += call("column_order",
+                      '\'' + column->id + "', '" + order + '\'');
+          continue;
+        }
+        sql += column_order(literals(*column), '\'' + order + '\'');
+        sql += cost(order_rank(literals(*column)));
+      }
+    }
+
+    // Remove extra columns
+    if (procedures) {
+      sql += call("extra_columns", literal_table.name);
+    } else {
+      sql += extra_columns(literal_table);
+      sql += cost("if (isnull(@drop_query), 0, 1)");
     }
 
     // Apply keys
     sql += R"(
 set @all_keys = '';
 )";
-    if (auto keys = table.at("keys"); keys) {
-      for (const auto &key : keys->get_array()) {
-        std::string key_def;
-        for (const auto &clm : key["columns"].get_array()) {
-          if (!key_def.empty()) {
-            key_def += ", ";
-          }
-          key_def += '`' + clm.get_string() + '`';
-        }
-        sql += R"(
+    for (const auto &key : table.keys) {
+      // Full text and spatial indexes can't be built without a lock
+      auto key_rank =
+          key.type.find("fulltext") == 0 || key.type.find("spatial") == 0
+              ? "2"
+              : "1";
+      // Value of `IS_VISIBLE` of the key
+      auto visible = key.invisible ? "NO" : "YES";
+      if (procedures) {
+        sql += call("key", '\'' + table.name + "', '" + key.name + "', '" +
+                               key.type + "', '" + key.column_ids + "', '" +
+                               key.quoted_columns + "', '" + visible +
+                               "', " + key_rank);
+        continue;
+      }
+      sql += R"(
 set @all_keys = concat(@all_keys, ')" +
-               key["name"].get_string() + R"( ');
+             key.name + R"( ');
 set @old_index = null;
 set @old_key_def = null;
+set @old_visible = null;
 select
-    `INDEX_NAME`,
-    group_concat(concat('`', `COLUMN_NAME`, '`')
-        ORDER BY `SEQ_IN_INDEX` SEPARATOR ', ')
+    `STATISTICS`.`INDEX_NAME`,
+    group_concat(`COLUMNS`.`COLUMN_COMMENT`
+        ORDER BY `SEQ_IN_INDEX` SEPARATOR ','),
+    max(`STATISTICS`.`IS_VISIBLE`)
 into
     @old_index,
-    @old_key_def
-from `INFORMATION_SCHEMA`.`STATISTICS`
+    @old_key_def,
+    @old_visible
+from )" + information("STATISTICS") +
+             R"(
+join )" + information("COLUMNS") +
+             R"(
+on
+    `STATISTICS`.`TABLE_SCHEMA` = `COLUMNS`.`TABLE_SCHEMA` and
+    `STATISTICS`.`TABLE_NAME` = `COLUMNS`.`TABLE_NAME` and
+    `STATISTICS`.`COLUMN_NAME` = `COLUMNS`.`COLUMN_NAME`
 where
-    `TABLE_SCHEMA` = ')" +
-               db_name + R"(' and
-    `TABLE_NAME` = ')" +
-               table["name"].get_string() + R"(' and
-    `INDEX_NAME` = ')" +
-               key["name"].get_string() + R"('
-group by `INDEX_NAME`;
+    `STATISTICS`.`TABLE_SCHEMA` = ')" +
+             db_name + R"(' and
+    `STATISTICS`.`TABLE_NAME` = ')" +
+             table.name + R"(' and
+    `STATISTICS`.`INDEX_NAME` = ')" +
+             key.name + "'" + changed + R"(
+group by `STATISTICS`.`INDEX_NAME`;
 set @old_ok = @old_key_def = ')" +
-               key_def + R"(';
+             key.column_ids + R"(';
 set @drop_query = if (@old_ok or isnull(@old_index), '',
     'DROP INDEX `)" +
-               key["name"].get_string() + R"(`, ');
+             key.name + R"(`, ');
 set @sub_query = concat(@sub_query, @drop_query);
 set @sub_query = if (@drop_query != '' or isnull(@old_index),
     concat(@sub_query, 'ADD )" +
-               key["type"].get_string() + R"( `)" + key["name"].get_string() +
-               R"(` ()" + key_def + R"(), ')
+             key_definition(key) + R"(, ')
 , @sub_query);
+set @sub_query = concat(@sub_query, if (@drop_query = '' and
+    @old_visible != ')" +
+             visible + R"(', 'ALTER INDEX `)" + key.name + "` " +
+             (key.invisible ? "INVISIBLE" : "VISIBLE") + R"(, ', ''));
 )";
-      }
+      // Changing the visibility only changes the metadata
+      sql += cost(std::string{"if (@drop_query != '' or "
+                              "isnull(@old_index), "} +
+                  key_rank + ", @old_visible != '" + visible + "')");
     }
 
-    // Remove extra keys
-    sql += R"(
-set @drop_query = null;
-select group_concat(distinct
-    concat('DROP INDEX `', `INDEX_NAME`, '`') SEPARATOR ', ')
-into @drop_query
-from `INFORMATION_SCHEMA`.`STATISTICS`
-join `INFORMATION_SCHEMA`.`KEY_COLUMN_USAGE`
-on
-    `INFORMATION_SCHEMA`.`STATISTICS`.`INDEX_SCHEMA` =
-    `INFORMATION_SCHEMA`.`KEY_COLUMN_USAGE`.`CONSTRAINT_SCHEMA` and
-    `INFORMATION_SCHEMA`.`STATISTICS`.`TABLE_NAME` =
-    `INFORMATION_SCHEMA`.`KEY_COLUMN_USAGE`.`TABLE_NAME` and
-    `INFORMATION_SCHEMA`.`STATISTICS`.`INDEX_NAME` =
-    `INFORMATION_SCHEMA`.`KEY_COLUMN_USAGE`.`CONSTRAINT_NAME`
-where
-    `INFORMATION_SCHEMA`.`KEY_COLUMN_USAGE`.`REFERENCED_TABLE_NAME` is null and
-    `INFORMATION_SCHEMA`.`STATISTICS`.`INDEX_SCHEMA` = ')" +
-           db_name + R"(' and
-    `INFORMATION_SCHEMA`.`STATISTICS`.`TABLE_NAME` = ')" +
-           table["name"].get_string() + R"(' and
-    instr(@all_keys, `INDEX_NAME`) = 0;
-set @sub_query = if (isnull(@drop_query), @sub_query,
-    concat(@sub_query, @drop_query, ', ')
-);
-)";
-    // Remove extra columns
-    sql += R"(
-set @drop_query = null;
-select group_concat(concat('DROP COLUMN `', `COLUMN_NAME`, '`')
-    SEPARATOR ', ') into @drop_query
-    from `INFORMATION_SCHEMA`.`COLUMNS`
-    where
-        `COLUMNS`.`TABLE_NAME` = ')" +
-           table["name"].get_string() + R"(' and
-        `COLUMNS`.`TABLE_SCHEMA` = ')" +
-           db_name + R"(' and
-        `COLUMN_NAME` like ')" +
-           bad_prefix + drop_prefix + R"(%';
-set @sub_query = if (isnull(@drop_query), @sub_query,
-    concat(@sub_query, @drop_query, ', ')
-);
+    // Remove extra keys and apply table engine
+    if (procedures) {
+      sql += call("extra_keys", literal_table.id + ", " + literal_table.name);
+      sql += call("engine", literal_table.name + ", " + literal_table.engine);
+    } else {
+      sql += extra_keys(literal_table);
+      sql += cost(extra_keys_rank);
+      sql += table_engine(literal_table);
+      sql += cost(engine_rank(literal_table));
+    }
+    if (options.fingerprints) {
+      sql += "set @sub_query = if (@table_unchanged, '', @sub_query);\n";
+    }
+    if (options.report) {
+      sql += R"(
+set @sql_rebuild = @sub_query != '' and @alter_cost = 2;
+set @sql_rebuilds = @sql_rebuilds + @sql_rebuild;
 )";
-    sql += R"(
-set @qry = if (@sub_query != '',
-    concat ('ALTER TABLE `)" +
-           db_name + R"(`.`)" + table["name"].get_string() +
-           R"(` ', substr(@sub_query, 1, length(@sub_query) - 2), ';')
+    }
+    if (shadow) {
+      // Pair the live column names with the defined ones for the copy
+      std::string ids, names;
+      for (const auto &column : table.columns) {
+        ids += ", '" + column.id + '\'';
+        names += ", '" + column.name + '\'';
+      }
+      sql += R"(
+set @shadow_from = null;
+set @shadow_to = null;
+select
+    group_concat(concat('`', `COLUMN_NAME`, '`')
+        ORDER BY `ORDINAL_POSITION` SEPARATOR ', '),
+    group_concat(concat('`', elt(field(`COLUMN_COMMENT`)" +
+             ids + ")" + names + R"(), '`')
+        ORDER BY `ORDINAL_POSITION` SEPARATOR ', ')
+into @shadow_from, @shadow_to
+from `INFORMATION_SCHEMA`.`COLUMNS`
+where `TABLE_SCHEMA` = ')" +
+             db_name + R"(' and `TABLE_NAME` = ')" + table.name +
+             R"(' and
+    field(`COLUMN_COMMENT`)" +
+             ids + R"() > 0 and @sub_query != '' and @alter_cost = 2;)" +
+             call("shadow", '\'' + table.name + "', '" + table.id + "', " +
+                                std::to_string(options.shadow_chunk_rows));
+    }
+    if (!algorithm.empty()) {
+      sql += algorithm_clause(table, algorithm);
+    }
+    auto ok = "'Table \"" + table.name + "\" is ok.'";
+    sql += procedures ? call("alter", literal_table.name + ", " + ok)
+                      : alter_table(literal_table, ok);
+    if (table.partitioning) {
+      sql += partition(table, changed);
+    }
+    if (options.staged_index_drops) {
+      // Forget the keys defined again or dropped, record the newly hidden
+      auto drops = '`' + db_name + "`.`" + index_drops_table + '`';
+      sql += R"(
+set @qry = if (instr(@index_hidden, '{)" +
+             table.id + R"(:') > 0,
+    concat('DELETE FROM )" +
+             drops + R"( WHERE `id` = \')" + table.id + R"(\'',
+        ifnull(concat(' AND (`id`, `index_name`) NOT IN (', @extra_keys,
+            ')'), ''), ';')
 ,
     'SET @r = \'Table ")" +
-           table["name"].get_string() + R"(" is ok.\';'
+             table.name + R"(" had no hidden index.\';'
 );
-)";
-    sql += exec;
-  }
-
-  for (const auto &table : tables.get_array()) {
-    // remove extra defaults
-    sql += R"(
-set @sub_query = '';
-)";
-    for (const auto &column : table["columns"].get_array()) {
-      if (!column.at("default")) {
-        sql +=
-            R"(
-set @old_default = null;
-select `COLUMN_DEFAULT`
-    into @old_default
-    from `INFORMATION_SCHEMA`.`COLUMNS`
-    where `COLUMN_NAME` = ')" +
-            column["name"].get_string() + R"(' and
-        `COLUMNS`.`TABLE_NAME` = ')" +
-            table["name"].get_string() + R"(' and
-        `COLUMNS`.`TABLE_SCHEMA` = ')" +
-            db_name + R"(';
-set @sub_query = if (@old_default IS NOT NULL,
-    concat(@sub_query, 'ALTER COLUMN `)" +
-            column["name"].get_string() + R"(` DROP DEFAULT, ')
+)" + exec + R"(
+set @qry = if (isnull(@extra_keys),
+    'SET @r = \'Table ")" +
+             table.name + R"(" has no extra index.\';'
 ,
-    @sub_query
+    concat('INSERT IGNORE INTO )" +
+             drops + R"( (`id`, `index_name`) VALUES ', @extra_keys, ';')
 );
-)";
-      }
+)" + exec;
     }
-
-    sql += R"(
-set @qry = if (@sub_query != '',
-    concat ('ALTER TABLE `)" +
-           db_name + R"(`.`)" + table["name"].get_string() +
-           R"(` ', substr(@sub_query, 1, length(@sub_query) - 2), ';')
-,
-    'SET @r = \'Table ")" +
-           table["name"].get_string() + R"(" is ok.\';'
-);
+    if (options.report) {
+      // Keep the ten slowest tables
+      sql += R"(
+set @sql_slowest = (select json_arrayagg(json_object(
+        'table', `table`, 'seconds', `seconds`, 'rebuild', `rebuild`))
+    from (select * from json_table(json_array_append(@sql_slowest, '$',
+            json_object('table', ')" +
+             table.name + R"(', 'seconds',
+                timestampdiff(microsecond, @sql_table_started, now(6)) / 1e6,
+                'rebuild', @sql_rebuild)),
+        '$[*]' columns (
+            `table` varchar(64) path '$.table',
+            `seconds` decimal(20, 6) path '$.seconds',
+            `rebuild` int path '$.rebuild')) as `tables`
+    order by `seconds` desc limit 10) as `slowest`);
 )";
-    sql += exec;
-  }
+    }
+    sql += sync({"KEY_COLUMN_USAGE"}, '\'' + table.name + '\'');
+  });
+  end_phase("Apply tables");
 
   // Remove extra tables
   sql += R"(
@@ -798,7 +1975,7 @@ set @sub_query = null;
 select group_concat(concat('`)" +
          db_name + R"(`.`', `TABLE_NAME`, '`')
     SEPARATOR ', ') into @sub_query
-from `INFORMATION_SCHEMA`.`TABLES`
+from )" + information("TABLES") + R"(
 where
     `TABLE_SCHEMA` = ')" +
          db_name + R"(' and
@@ -808,143 +1985,214 @@ set @qry = if (isnull(@sub_query), 'SET @r = \'No extra table.\';',
     concat('DROP TABLE ', @sub_query, ';')
 );
 )";
-  sql += exec;
+  execute();
+  sql += sync({"KEY_COLUMN_USAGE"});
+  end_phase("Remove extra tables");
 
-  // Create foreign keys
-  for (const auto &table : tables.get_array()) {
-    if (auto foreign_keys = table.at("foreign-keys"); foreign_keys) {
-      for (const auto &key : foreign_keys->get_array()) {
-        sql += R"(
-set @old_constraint = null;
-set @old_table = null;
-set @old_key_def = null;
-set @old_referenced_table = null;
-set @old_f_key_def = null;
-select `CONSTRAINT_NAME` into @old_constraint
-from `INFORMATION_SCHEMA`.`KEY_COLUMN_USAGE`
-where
-    `REFERENCED_TABLE_NAME` is not null and
-    `TABLE_SCHEMA` = ')" +
-               db_name + R"(' and
-    `CONSTRAINT_NAME` = ')" +
-               key["name"].get_string() + R"('
-group by `CONSTRAINT_NAME`;
-set @create_query = if (isnull(@old_constraint),
-    concat('ALTER TABLE `)" +
-               db_name + R"(`.`)" + table["name"].get_string() +
-               R"(` ADD CONSTRAINT `)" + key["name"].get_string() +
-               R"(` FOREIGN KEY ()" +
-               fk_flatten_columns[table["name"].get_string()]
-                                 [key["name"].get_string()]
-                                     .first +
-               R"() REFERENCES `)" + db_name + R"(`.`)" +
-               key["table"].get_string() + R"(` ()" +
-               fk_flatten_columns[table["name"].get_string()]
-                                 [key["name"].get_string()]
-                                     .second +
-               R"() ON UPDATE )" + key["update"].get_string() +
-               R"( ON DELETE )" + key["delete"].get_string() + R"(;')
-    , '');
-set @qry = if (@create_query != '', @create_query,
-    'SET @r = \'Foreign key ")" +
-               key["name"].get_string() + R"(" is ok.\';');
+  // Create foreign keys. With checks, adding a foreign key copies the
+  // table. Under a policy below copy, and for a table rebuilt through a
+  // shadow copy, which lost its foreign keys, they are added in place without
+  // checks once no row of an existing table lacks its parent; otherwise they
+  // keep the copy the policy refuses.
+  each_table([&](const schema_table &table, std::string &sql) {
+    if (table.foreign_keys.empty()) {
+      return;
+    }
+    auto algorithm = table_algorithm(table);
+    auto unchecked = !algorithm.empty() && algorithm_rank(algorithm) < 2;
+    auto orphans = unchecked || shadow;
+    sql += R"(
+set @sub_query = '';
 )";
-        sql += exec;
+    if (unchecked) {
+      sql += R"(set @alter_cost = 1;
+)";
+    } else if (shadow) {
+      sql += R"(set @alter_cost = if (instr(@shadow_tables, '{)" +
+             table.name + R"(}') > 0, 1, 2);
+)";
+    }
+    for (const auto &key : table.foreign_keys) {
+      auto name = '\'' + key.name + '\'';
+      auto definition = "'FOREIGN KEY (" + key.quoted_columns +
+                        ") REFERENCES `" + db_name + "`.`" + key.table +
+                        "` (" + key.quoted_keys + ") ON UPDATE " +
+                        key.on_update + " ON DELETE " + key.on_delete + '\'';
+      sql += procedures ? call("constraint", name + ", " + definition)
+                        : add_constraint(name, definition);
+      if (orphans && !options.dry_run) {
+        sql += R"(set @fk_orphan = null;
+set @fk_query = if (@alter_cost < 2 and isnull(@old_constraint) and
+        instr(@new_tables, '{)" +
+               table.name + R"(}') = 0,
+    ')" + orphan_select(db_name, table, key) +
+               R"( INTO @fk_orphan',
+    'SET @r = null');
+prepare stmt from @fk_query;
+execute stmt;
+deallocate prepare stmt;
+set @alter_cost = greatest(@alter_cost, if (isnull(@fk_orphan), 1, 2));
+)";
+        if (options.report) {
+          sql += R"(select 'Table ")" + table.name +
+                 R"(" has rows without a parent for foreign key ")" +
+                 key.name + R"(".' as ''
+from dual where @fk_orphan;
+)";
+        }
+      }
+    }
+    if (!algorithm.empty()) {
+      if (!orphans) {
+        sql += "\nset @alter_cost = 2;";
       }
+      sql += algorithm_clause(table, algorithm);
+    }
+    if (orphans) {
+      sql += R"(
+set @sql_fk_checks = @@foreign_key_checks;
+set foreign_key_checks = if (@alter_cost < 2, 0, @sql_fk_checks);)";
+    }
+    auto literal_table = table_literals(table);
+    auto ok = "'Foreign keys of \"" + table.name + "\" are ok.'";
+    sql += procedures ? call("alter", literal_table.name + ", " + ok)
+                      : alter_table(literal_table, ok);
+    if (orphans) {
+      sql += R"(set foreign_key_checks = @sql_fk_checks;
+)";
+    }
+  });
+  end_phase("Create foreign keys");
+
+  // Store fingerprints
+  if (options.fingerprints && !tables.tables.empty()) {
+    std::string values;
+    for (const auto &table : tables.tables) {
+      values += (values.empty() ? "\n    (\\'" : ",\n    (\\'") + table.id +
+                "\\', \\'" + table.fingerprint + "\\')";
     }
+    sql += R"(
+set @qry = 'INSERT `)" +
+           db_name + "`.`" + fingerprints_table +
+           R"(` (`id`, `fingerprint`) VALUES)" + values + R"(
+AS `new` ON DUPLICATE KEY UPDATE `fingerprint` = `new`.`fingerprint`;';
+)";
+    execute();
+    sql += R"(
+set @qry = 'DELETE FROM `)" +
+           db_name + "`.`" + fingerprints_table + R"(`
+WHERE instr(@all_tables, concat(\'{\', `id`, \'}\')) = 0;';
+)";
+    execute();
+    end_phase("Store fingerprints");
   }
 
-  // Create views
-  for (const auto &table : tables.get_array()) {
-    if (auto views = table.at("views"); views) {
-      for (const auto &view : views->get_array()) {
-        sql += R"(
-set @qry = 'CREATE OR REPLACE VIEW `)" +
-               db_name + R"(`.`)" + view["name"].get_string() + R"(` AS SELECT
+  // Create views, after the views they join. A view in place is only
+  // replaced when the definition the server keeps for a probe view of the
+  // SELECT differs from its own. A dry run can't create the probe and
+  // replaces the views in place.
+  auto probe = '`' + db_name + "`.`" + bad_prefix + "probe`";
+  each(tables.view_order, [&](const auto &at, std::string &sql) {
+    const auto &table = tables.tables[at.first];
+    const auto &view = table.views[at.second];
+    sql += R"(
+set @view_select = ')" +
+           view_select(db_name, table, view) + R"(';
+set @old_view = null;
+select `VIEW_DEFINITION` into @old_view
+    from `INFORMATION_SCHEMA`.`VIEWS`
+    where `TABLE_SCHEMA` = ')" +
+           db_name + "' and `TABLE_NAME` = '" + view.name + R"(';
+set @new_view = null;
+)";
+    if (options.dry_run) {
+      if (options.report) {
+        sql += R"(select if (isnull(@old_view), '',
+    'View ")" + view.name +
+               R"(" would be compared and replaced if changed.') as '';
 )";
-        std::string columns;
-        for (const auto &clm : view["columns"].get_array()) {
-          if (!columns.empty()) {
-            columns += ", ";
-          }
-          columns +=
-              "`" + table["name"].get_string() + "`.`" + clm.get_string() + "`";
-        }
-        std::string from = R"( FROM `)" + db_name + R"(`.`)" +
-                           table["name"].get_string() + R"(` )";
-        for (const auto &joint : view["joints"].get_array()) {
-          from += joint["type"].get_string() + R"( join `)" + db_name +
-                  R"(`.`)" + joint["table"].get_string() + R"(` AS `)" +
-                  joint["as"].get_string() + R"(` ON )";
-          std::string ons;
-          for (const auto &on : joint["ons"].get_array()) {
-            if (!ons.empty()) {
-              ons += "AND ";
-            }
-            ons += R"(`)" + db_name + R"(`.`)" +
-                   on["base"]["table"].get_string() + R"(`.`)" +
-                   on["base"]["column"].get_string() + R"(` = `)" + db_name +
-                   R"(`.`)" + joint["as"].get_string() + R"(`.`)" +
-                   on["foreign"].get_string() + R"(` )";
-          }
-          from += ons;
-          for (const auto &clm : joint["columns"].get_array()) {
-            if (!columns.empty()) {
-              columns += ", ";
-            }
-            columns += R"(`)" + db_name + R"(`.`)" + joint["as"].get_string() +
-                       R"(`.`)" + clm["name"].get_string() + R"(` AS `)" +
-                       clm["as"].get_string() + "`";
-          }
-        }
-        sql += columns + from + R"(;';)";
-        sql += exec;
       }
+    } else {
+      sql += R"(set @probe_query = if (isnull(@old_view), 'SET @r = null;',
+    concat('CREATE OR REPLACE VIEW )" +
+             probe + R"( AS ', @view_select, ';'));
+prepare stmt from @probe_query;
+execute stmt;
+deallocate prepare stmt;
+select `VIEW_DEFINITION` into @new_view
+    from `INFORMATION_SCHEMA`.`VIEWS`
+    where `TABLE_SCHEMA` = ')" +
+             db_name + "' and `TABLE_NAME` = '" + bad_prefix + R"(probe';
+set @probe_query = if (isnull(@new_view), 'SET @r = null;',
+    'DROP VIEW )" +
+             probe + R"(;');
+prepare stmt from @probe_query;
+execute stmt;
+deallocate prepare stmt;
+)";
     }
-  }
+    sql += R"(set @qry = if (@old_view = @new_view,
+    'SET @r = \'View ")" +
+           view.name + R"(" is ok.\';'
+,
+    concat('CREATE OR REPLACE VIEW `)" +
+           db_name + "`.`" + view.name + R"(` AS ', @view_select, ';')
+);
+)";
+    sql += exec;
+  });
+  end_phase("Create views");
 
   // Insert rows
-  for (const auto &table : tables.get_array()) {
-    if (auto rows = table.at("rows"); rows) {
-      sql += R"(
+  auto escape = [](const std::string &text) {
+    std::string escaped;
+    for (const auto c : text) {
+      if (c == '\'') {
+        escaped += "\\'";
+      } else {
+        escaped += c;
+      }
+    }
+    return escaped;
+  };
+  each_table([&](const schema_table &table, std::string &sql) {
+    if (table.rows.empty()) {
+      return;
+    }
+    if (options.reconcile_rows && !table.primary.empty()) {
+      for (const auto &statement : reconcile_statements(
+               db_name, table, options.batch_rows, options.batch_bytes,
+               options.delete_stale_rows)) {
+        sql += "\nset @qry = '" + escape(statement) + "';\n";
+        sql += exec;
+      }
+      return;
+    }
+    sql += R"(
 set @row_count = 0;
 SELECT COUNT(*) into @row_count FROM `)" +
-             db_name + R"(`.`)" + table["name"].get_string() + R"(`;
+           db_name + R"(`.`)" + table.name + R"(`;
 )";
-      for (const auto &row : rows->get_array()) {
-        std::string values;
-        sql += R"(
-set @sub_query = 'INSERT `)" +
-               db_name + R"(`.`)" + table["name"].get_string() +
-               R"(`(
-)";
-        for (const auto &clm : row.get_object()) {
-          if (!values.empty()) {
-            sql += ", ";
-            values += ", ";
-          }
-          sql += '`' + clm.first + '`';
-          for (const auto c : clm.second.get_string()) {
-            if (c == '\'') {
-              values += "\\'";
-            } else {
-              values += c;
-            }
-          }
-        }
-        sql += ")VALUES(" + values + R"();';
+    for (const auto &batch :
+         row_batches(table.rows, options.batch_rows, options.batch_bytes)) {
+      std::string values;
+      for (const auto &row : batch.rows) {
+        values += (values.empty() ? "(" : ", (") + escape(row) + ')';
+      }
+      sql += R"(
 set @qry = if (@row_count != 0,
     'SET @r = \'No rows inserted for ")" +
-               table["name"].get_string() +
-               R"(".\';'
+             table.name + R"(".\';'
 ,
-    @sub_query
+    'INSERT `)" + db_name +
+             R"(`.`)" + table.name + R"(`()" + batch.columns +
+             R"()VALUES)" + values + R"(;'
 );
 )";
-        sql += exec;
-      }
+      sql += exec;
     }
-  }
+  });
+  end_phase("Insert rows");
 
   // Apply users
   std::size_t index = 0;
@@ -963,7 +2211,7 @@ set @qry = if (isnull(@old_user),
            user["name"].get_string() + R"(" exists.\';'
 );
 )";
-    sql += exec;
+    execute();
     sql += "set @all_grants = ' ";
     // Revoke permissions of extra tables
     for (const auto &permission : user["permissions"].get_array()) {
@@ -991,7 +2239,7 @@ set @qry = if (isnull(@sub_query),
            R"(\';'
 );
 )";
-    sql += exec;
+    execute();
 
     // Adjust permissions
     for (const auto &permission : user["permissions"].get_array()) {
@@ -1038,7 +2286,7 @@ set @qry = if (@old_grant = ')" +
                user["name"].get_string() + R"(\';'
 );
 )";
-        sql += exec;
+        execute();
       }
       if (!revoke_operations.empty()) {
         sql += R"(
@@ -1054,10 +2302,61 @@ set @qry = if (@old_grant = ')" +
                user["name"].get_string() + R"(\';'
 );
 )";
-        sql += exec;
+        execute();
       }
     }
   }
+  end_phase("Apply users");
+
+  // Remove procedures
+  if (shadow) {
+    sql += "\nDROP PROCEDURE IF EXISTS `" + db_name + "`.`" + bad_prefix +
+           "shadow`;\n";
+  }
+  if (procedures) {
+    for (const auto *name :
+         {"run", "foreign_key", "column", "column_order", "key", "table",
+          "rename", "extra_foreign_keys", "kept_columns", "extra_columns",
+          "extra_keys", "engine", "alter", "constraint"}) {
+      sql += "\nDROP PROCEDURE IF EXISTS `" + db_name + "`.`" + bad_prefix +
+             name + "`;";
+    }
+    sql += '\n';
+  }
+  if (shadow || procedures) {
+    end_phase("Remove procedures");
+  }
+
+  // Summarize the timings
+  if (options.report) {
+    sql += R"(
+select `phase` as 'Phase', `seconds` as 'Seconds'
+from json_table(@sql_phases, '$[*]' columns (
+    `phase` varchar(64) path '$.phase',
+    `seconds` decimal(20, 6) path '$.seconds')) as `phases`;
+select `table` as 'Slowest table', `seconds` as 'Seconds',
+    `rebuild` as 'Rebuild'
+from json_table(@sql_slowest, '$[*]' columns (
+    `table` varchar(64) path '$.table',
+    `seconds` decimal(20, 6) path '$.seconds',
+    `rebuild` int path '$.rebuild')) as `tables`
+order by `seconds` desc;
+select
+    timestampdiff(microsecond, @sql_started, now(6)) / 1e6 as 'Seconds',
+    @sql_executed as 'Executed',
+    @sql_skipped as 'Skipped',
+    @sql_rebuilds as 'Rebuilds';
+)";
+  }
 
-  return sql;
+  out << sql;
+  out.flush();
+  if (!out) {
+    sink.setstate(std::ios::badbit);
+  }
+  if (options.stats) {
+    options.stats->bytes = counter.count;
+    options.stats->seconds =
+        std::chrono::duration<double>(clock::now() - started).count();
+  }
 }
@@ -1,12 +1,172 @@
 #ifndef SQLR_H
 #define SQLR_H
 
+#include <ostream>
 #include <string>
+#include <vector>
 
 #include <json.hpp>
 
+#include "schema.h"
+
+// Bytes of SQL written by a phase of replicate_sql() and the wall time spent
+// generating them.
+struct replicate_phase_stats {
+  std::string phase;
+  std::size_t bytes = 0;
+  double seconds = 0;
+};
+
+struct replicate_stats {
+  // In the order of the output.
+  std::vector<replicate_phase_stats> phases;
+  std::size_t bytes = 0;
+  double seconds = 0;
+};
+
+struct replicate_options {
+  // Add informative logs to the SQL output. replicate_sql() also times the
+  // phases and the tables on the server and ends with a summary of them.
+  bool report = false;
+  // List the required changes without applying them.
+  bool dry_run = false;
+  // Copy the INFORMATION_SCHEMA rows of the database into indexed temporary
+  // tables once and run every lookup against them. Ignored by a dry run.
+  bool snapshot = false;
+  // Online DDL policy of the ALTER TABLE statements, the most expensive
+  // algorithm allowed: "instant", "inplace" (with LOCK=NONE) or "copy". Empty
+  // leaves the choice to the server. A table can override it.
+  std::string algorithm;
+  // Most rows and bytes of values per multi-row seed INSERT. The statements
+  // have to fit in the max_allowed_packet of the server.
+  std::size_t batch_rows = 1000;
+  std::size_t batch_bytes = 1 << 20;
+  // Reconcile the seed rows of the tables with a primary key by the key,
+  // inserting the missing rows and updating the changed ones, instead of only
+  // seeding empty tables. Optionally delete the rows that are not seed rows.
+  bool reconcile_rows = false;
+  bool delete_stale_rows = false;
+  // Threads generating the per-table parts of the script. The output is the
+  // same for any number of threads.
+  std::size_t threads = 1;
+  // Keep the fingerprint of every applied table in the database and skip the
+  // column, key and foreign key checks of the tables whose definition didn't
+  // change since.
+  bool fingerprints = false;
+  // Install stored procedures checking a column, a key and a foreign key and
+  // doing the steps around them, and call them instead of repeating the
+  // checks for every table and object. The script then uses DELIMITER and
+  // has to be run by the mysql client. Ignored by a dry run.
+  bool procedures = false;
+  // Leave the physical order of the existing columns alone and append the
+  // new columns, which lets them be added with ALGORITHM=INSTANT. Otherwise
+  // only the columns off the longest run already in order are moved.
+  bool ignore_column_order = false;
+  // Tables holding at least shadow_bytes bytes of data, whose changes need a
+  // table copy, are rebuilt through a shadow table filled in primary key
+  // order by chunks of shadow_chunk_rows rows and swapped in by one RENAME
+  // TABLE. Zero keeps the single ALTER TABLE.
+  std::size_t shadow_bytes = 0;
+  std::size_t shadow_chunk_rows = 10000;
+  // Extra keys are made INVISIBLE first, which only changes the metadata,
+  // and dropped by a later run once they stayed invisible for
+  // index_drop_grace_days days, so a key still needed can be made visible
+  // again at no cost. The primary key can't be invisible and is dropped at
+  // once.
+  bool staged_index_drops = false;
+  std::size_t index_drop_grace_days = 7;
+  // Foreign keys whose columns don't start a key of their table: "warn"
+  // lists them as comments at the top of the output, "add" indexes them
+  // through index_foreign_keys(). Empty leaves them to the server.
+  std::string foreign_key_indexes;
+  // Keys made useless by another key of their table, see redundant_keys():
+  // "warn" lists them as comments at the top of the output, "strict" refuses
+  // to generate the script. Empty doesn't look for them.
+  std::string redundant_keys;
+  // Reset and filled with the generation counters of every phase of
+  // replicate_sql() when set.
+  replicate_stats *stats = nullptr;
+};
+
+// Write the script to the stream statement by statement, so only one
+// statement is held in memory at a time. Any chunked writer can be plugged in
+// through a std::streambuf.
+void replicate_sql(std::ostream &out, const std::string &db_name,
+                   const jsonio::json &tables, const jsonio::json &users,
+                   const replicate_options &options);
+
+// Same as above from tables compiled by compile_schema(), to generate scripts
+// for several databases without resolving the definitions again.
+void replicate_sql(std::ostream &out, const std::string &db_name,
+                   const schema &tables, const jsonio::json &users,
+                   const replicate_options &options);
+
+std::string replicate_sql(const std::string &db_name,
+                          const jsonio::json &tables, const jsonio::json &users,
+                          const replicate_options &options);
+
 std::string replicate_sql(const std::string &db_name,
                           const jsonio::json &tables, const jsonio::json &users,
                           bool report, bool dry_run);
 
+// Script of replicate_sql() generated once for any database: the text
+// without the database name and the offsets where the name goes.
+struct sql_template {
+  std::string text;
+  std::vector<std::size_t> slots;
+};
+
+sql_template replicate_template(const schema &tables,
+                                const jsonio::json &users,
+                                const replicate_options &options);
+
+// Throw when the database name can't be written into a script, as
+// write_sql() does, to check every name before writing any script.
+void check_database_name(const std::string &db_name);
+
+// Write the script of the template for the database, the same as the one
+// replicate_sql() generates for it.
+void write_sql(std::ostream &out, const sql_template &script,
+               const std::string &db_name);
+
+// Scripts of several databases, one after another, from one generation.
+void replicate_sql(std::ostream &out, const std::vector<std::string> &db_names,
+                   const schema &tables, const jsonio::json &users,
+                   const replicate_options &options);
+
+// Query exporting the live schema of the database as the JSON snapshot taken
+// by diff_sql().
+std::string snapshot_sql(const std::string &db_name);
+
+// Diff the definitions against a snapshot exported by snapshot_sql() and
+// generate only the needed statements, without server side branching. The
+// output is never executed by itself, so dry_run and snapshot are ignored.
+void diff_sql(std::ostream &out, const std::string &db_name,
+              const jsonio::json &tables, const jsonio::json &users,
+              const jsonio::json &live, const replicate_options &options);
+
+void diff_sql(std::ostream &out, const std::string &db_name,
+              const schema &tables, const jsonio::json &users,
+              const jsonio::json &live, const replicate_options &options);
+
+std::string diff_sql(const std::string &db_name, const jsonio::json &tables,
+                     const jsonio::json &users, const jsonio::json &live,
+                     const replicate_options &options);
+
+// Plan of the changes diff_sql() would make, as a JSON document listing the
+// operations of every changed table with the expected online DDL algorithm,
+// along with the estimated rows and data length of the table from the
+// snapshot, to schedule the expensive migrations.
+void plan_json(std::ostream &out, const std::string &db_name,
+               const jsonio::json &tables, const jsonio::json &users,
+               const jsonio::json &live, const replicate_options &options);
+
+void plan_json(std::ostream &out, const std::string &db_name,
+               const schema &tables, const jsonio::json &users,
+               const jsonio::json &live, const replicate_options &options);
+
+std::string plan_json(const std::string &db_name, const jsonio::json &tables,
+                      const jsonio::json &users, const jsonio::json &live,
+                      const replicate_options &options);
+
 #endif // SQLR_H
@@ -0,0 +1,159 @@
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+// Checks of the helpers ordering the columns and batching the seed rows.
+
+namespace {
+
+int failures = 0;
+
+void expect(bool condition, const char *what) {
+  if (!condition) {
+    std::fprintf(stderr, "failed: %s\n", what);
+    ++failures;
+  }
+}
+
+std::vector<bool> flags(std::initializer_list<int> values) {
+  std::vector<bool> result;
+  for (auto value : values) {
+    result.push_back(value != 0);
+  }
+  return result;
+}
+
+schema_row row(std::vector<std::string> names,
+               std::vector<std::string> values) {
+  return {std::move(names), std::move(values)};
+}
+
+void longest_increasing_tests() {
+  expect(longest_increasing({}).empty(), "longest_increasing of nothing");
+  expect(longest_increasing({0, 1, 2, 3}) == flags({1, 1, 1, 1}),
+         "longest_increasing keeps a sorted sequence");
+  expect(longest_increasing({3, 2, 1, 0}).size() == 4 &&
+             longest_increasing({3, 2, 1, 0}) != flags({0, 0, 0, 0}),
+         "longest_increasing keeps one of a reversed sequence");
+  // Inserting a column moves only the new one
+  expect(longest_increasing({0, 1, 4, 2, 3}) == flags({1, 1, 0, 1, 1}),
+         "longest_increasing moves the misplaced column");
+  expect(longest_increasing({1, 2, 3, 0}) == flags({1, 1, 1, 0}),
+         "longest_increasing moves the first column to the end");
+  auto kept = longest_increasing({2, 0, 3, 1, 4});
+  std::size_t count = 0;
+  std::size_t last = 0;
+  bool increasing = true;
+  const std::size_t sequence[] = {2, 0, 3, 1, 4};
+  for (std::size_t i = 0; i < kept.size(); ++i) {
+    if (kept[i]) {
+      increasing = increasing && (count == 0 || sequence[i] > last);
+      last = sequence[i];
+      ++count;
+    }
+  }
+  expect(count == 3 && increasing,
+         "longest_increasing keeps a longest increasing run");
+}
+
+void row_batches_tests() {
+  std::vector<schema_row> rows{
+      row({"id", "name"}, {"1", "'a'"}), row({"id", "name"}, {"2", "'b'"}),
+      row({"id", "name"}, {"3", "'c'"}), row({"id"}, {"4"}),
+      row({"id", "name"}, {"5", "'e'"})};
+  auto batches = row_batches(rows, 2, 1 << 20);
+  expect(batches.size() == 4, "row_batches splits by rows and columns");
+  expect(batches[0].columns == "`id`, `name`" &&
+             batches[0].rows == std::vector<std::string>{"1, 'a'", "2, 'b'"},
+         "row_batches fills the first batch");
+  expect(batches[1].rows == std::vector<std::string>{"3, 'c'"},
+         "row_batches starts a batch at the row limit");
+  expect(batches[2].columns == "`id`" &&
+             batches[2].names == std::vector<std::string>{"id"},
+         "row_batches starts a batch on other columns");
+  expect(batches[3].rows.size() == 1, "row_batches doesn't merge back");
+
+  // "1, 'a'" and "2, 'b'" are 6 bytes each
+  batches = row_batches(rows, 1000, 12);
+  expect(batches.size() == 4 && batches[0].rows.size() == 2 &&
+             batches[1].rows.size() == 1,
+         "row_batches splits by bytes");
+  batches = row_batches(rows, 1000, 1);
+  expect(batches.size() == 5, "row_batches keeps a row larger than a batch");
+
+  expect(row_batches({}, 10, 10).empty(), "row_batches of no rows");
+  bool thrown = false;
+  try {
+    row_batches(rows, 0, 10);
+  } catch (const std::runtime_error &) {
+    thrown = true;
+  }
+  expect(thrown, "row_batches refuses an empty batch");
+}
+
+void reconcile_statements_tests() {
+  schema_table table;
+  table.name = "t";
+  table.primary = {"id"};
+  table.rows = {row({"id", "name"}, {"1", "'a'"}),
+                row({"id", "name"}, {"2", "'b'"})};
+  auto statements = reconcile_statements("db", table, 1000, 1 << 20, false);
+  expect(statements ==
+             std::vector<std::string>{
+                 "INSERT `db`.`t`(`id`, `name`) SELECT * FROM (VALUES "
+                 "ROW(1, 'a'), ROW(2, 'b')) AS `rows` (`id`, `name`) WHERE "
+                 "NOT EXISTS (SELECT 1 FROM `db`.`t` AS `live` WHERE "
+                 "`live`.`id` <=> `rows`.`id` AND `live`.`name` <=> "
+                 "`rows`.`name`) ON DUPLICATE KEY UPDATE `name` = "
+                 "`rows`.`name`;"},
+         "reconcile_statements upserts the changed rows");
+
+  statements = reconcile_statements("db", table, 1, 1 << 20, true);
+  expect(statements.size() == 8, "reconcile_statements deletes stale rows");
+  expect(statements[2] == "DROP TEMPORARY TABLE IF EXISTS `db`.`_sql_seed`;",
+         "reconcile_statements collects the seed keys");
+  expect(statements[4] == "INSERT `db`.`_sql_seed`(`id`) VALUES(1);" &&
+             statements[5] == "INSERT `db`.`_sql_seed`(`id`) VALUES(2);",
+         "reconcile_statements batches the seed keys");
+  expect(statements[6] ==
+             "DELETE `live` FROM `db`.`t` AS `live` LEFT JOIN "
+             "`db`.`_sql_seed` AS `seed` USING (`id`) WHERE `seed`.`id` IS "
+             "NULL;",
+         "reconcile_statements deletes the rows missing from the seed");
+
+  // Keys larger than a batch are collected one per statement
+  table.rows = {row({"id"}, {"10"}), row({"id"}, {"20"})};
+  statements = reconcile_statements("db", table, 1000, 1, true);
+  expect(statements.size() == 8 &&
+             statements[4] == "INSERT `db`.`_sql_seed`(`id`) VALUES(10);" &&
+             statements[5] == "INSERT `db`.`_sql_seed`(`id`) VALUES(20);",
+         "reconcile_statements never collects an empty batch");
+
+  // Only the key columns: nothing to update
+  table.rows = {row({"id"}, {"1"})};
+  statements = reconcile_statements("db", table, 1000, 1 << 20, false);
+  expect(statements.size() == 1 &&
+             statements[0].find("ON DUPLICATE KEY") == std::string::npos,
+         "reconcile_statements inserts rows of key columns only");
+
+  table.rows = {row({"name"}, {"'a'"})};
+  bool thrown = false;
+  try {
+    reconcile_statements("db", table, 1000, 1 << 20, false);
+  } catch (const std::runtime_error &) {
+    thrown = true;
+  }
+  expect(thrown, "reconcile_statements refuses a row without its key");
+}
+
+} // namespace
+
+int main() {
+  longest_increasing_tests();
+  row_batches_tests();
+  reconcile_statements_tests();
+  return failures == 0 ? 0 : 1;
+}
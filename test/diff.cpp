@@ -0,0 +1,494 @@
+#include <array>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "sqlr.h"
+
+// Checks of the offline diff and of its migration plan against a small
+// snapshot.
+
+namespace {
+
+int failures = 0;
+
+void expect(bool condition, const char *what) {
+  if (!condition) {
+    std::fprintf(stderr, "failed: %s\n", what);
+    ++failures;
+  }
+}
+
+jsonio::json parse(const std::string &text) {
+  jsonio::json value;
+  std::istringstream{text} >> value;
+  return value;
+}
+
+bool contains(const std::string &text, const std::string &part) {
+  return text.find(part) != std::string::npos;
+}
+
+const char tables_json[] = R"json([
+  {"id": "A", "name": "user", "columns": [
+      {"id": "a1", "name": "id", "type": "int unsigned", "auto": true},
+      {"id": "a2", "name": "name", "type": "varchar(64)"},
+      {"id": "a4", "name": "score", "type": "int", "default": "0"}],
+    "keys": [{"name": "PRIMARY", "type": "primary key", "columns": ["id"]}]},
+  {"id": "B", "name": "member", "columns": [
+      {"id": "b1", "name": "id", "type": "int unsigned", "auto": true},
+      {"id": "b2", "name": "user", "type": "int unsigned"}],
+    "keys": [{"name": "PRIMARY", "type": "primary key", "columns": ["id"]},
+      {"name": "ix_user", "type": "index", "columns": ["user"]}],
+    "foreign-keys": [{"name": "fk_user", "table": "user",
+      "columns": ["user"], "keys": ["id"], "update": "cascade",
+      "delete": "cascade"}]}
+])json";
+
+// Live schema as snapshot_sql() exports it
+const char live_json[] = R"json({"schemata": ["db"],
+  "tables": [
+    {"name": "people", "type": "BASE TABLE", "engine": "InnoDB",
+      "comment": "A", "rows": "10", "data-length": "16384"},
+    {"name": "legacy", "type": "BASE TABLE", "engine": "InnoDB",
+      "comment": "Z"}],
+  "columns": [
+    {"table": "people", "name": "id", "position": "1",
+      "type": "int unsigned", "null": "NO", "extra": "auto_increment",
+      "comment": "a1"},
+    {"table": "people", "name": "name", "position": "2",
+      "type": "varchar(64)", "null": "NO", "extra": "", "comment": "a2"},
+    {"table": "people", "name": "score", "position": "3", "type": "int",
+      "null": "NO", "extra": "", "comment": "a4", "default": "1"},
+    {"table": "legacy", "name": "id", "position": "1", "type": "int",
+      "null": "NO", "extra": "", "comment": "z1"}],
+  "indexes": [
+    {"table": "people", "name": "PRIMARY", "unique": "YES",
+      "columns": ["id"]}],
+  "foreign-keys": [],
+  "users": [],
+  "grants": []
+})json";
+
+void diff_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse("[]");
+  auto live = parse(live_json);
+  replicate_options options;
+  auto sql = diff_sql("db", tables, users, live, options);
+
+  expect(!contains(sql, "CREATE DATABASE"), "diff_sql keeps the database");
+  expect(contains(sql, "DROP TABLE `db`.`legacy`;"),
+         "diff_sql drops an extra table");
+  expect(contains(sql, "RENAME TABLE `db`.`people` to `db`.`user`;"),
+         "diff_sql renames a table matched by its id");
+  expect(!contains(sql, "MODIFY COLUMN `name`"),
+         "diff_sql leaves an unchanged column alone");
+  expect(contains(sql, "MODIFY COLUMN `score` int DEFAULT 0 not null"),
+         "diff_sql modifies a changed default");
+  expect(contains(sql, "CREATE TABLE `db`.`member`"),
+         "diff_sql creates a missing table");
+  expect(contains(sql, "ADD CONSTRAINT `fk_user` FOREIGN KEY (`user`) "
+                       "REFERENCES `db`.`user` (`id`)"),
+         "diff_sql adds a missing foreign key");
+
+  // The table swapped out by a shadow copy during writes is kept
+  live["tables"].get_array().push_back(
+      parse(R"({"name": "_sql__stale_user", "type": "BASE TABLE", )"
+            R"("engine": "InnoDB", "comment": ""})"));
+  expect(!contains(diff_sql("db", tables, users, live, options),
+                   "_sql__stale_user"),
+         "diff_sql keeps a stale shadow table");
+
+  live["schemata"] = parse("[]");
+  live["tables"] = parse("[]");
+  sql = diff_sql("db", tables, users, live, options);
+  expect(contains(sql, "CREATE DATABASE `db`;") &&
+             contains(sql, "CREATE TABLE `db`.`user`"),
+         "diff_sql creates a missing database");
+
+  std::ostringstream out;
+  diff_sql(out, "db", tables, users, live, options);
+  expect(out.str() == sql, "diff_sql streams the statements it returns");
+
+  expect(contains(snapshot_sql("db"), "where `TABLE_SCHEMA` = 'db'"),
+         "snapshot_sql exports the database");
+}
+
+void default_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse("[]");
+  auto live = parse(live_json);
+  // Defaults as written in the definitions and as the server shows them
+  auto &columns = tables.get_array()[0]["columns"].get_array();
+  columns[1]["default"] = parse(R"("\"say \\\"hi\\\"\"")");
+  columns.insert(columns.begin() + 2,
+                 parse(R"json({"id": "a3", "name": "seen",
+                     "type": "timestamp", "default": "now()"})json"));
+  auto &live_columns = live["columns"].get_array();
+  live_columns[1]["default"] = parse(R"("say \"hi\"")");
+  live_columns[2]["position"] = parse(R"("4")");
+  live_columns.insert(live_columns.begin() + 2,
+                      parse(R"({"table": "people", "name": "seen",
+                          "position": "3", "type": "timestamp", "null": "NO",
+                          "extra": "DEFAULT_GENERATED", "comment": "a3",
+                          "default": "CURRENT_TIMESTAMP"})"));
+  replicate_options options;
+  auto sql = diff_sql("db", tables, users, live, options);
+  expect(!contains(sql, "MODIFY COLUMN `name`"),
+         "diff_sql compares a string default unquoted");
+  expect(!contains(sql, "MODIFY COLUMN `seen`"),
+         "diff_sql compares now() as CURRENT_TIMESTAMP");
+  expect(contains(sql, "MODIFY COLUMN `score` int DEFAULT 0 not null"),
+         "diff_sql still modifies a changed default");
+  auto plan = parse(plan_json("db", tables, users, live, options));
+  auto modified = [&](const std::string &column) {
+    for (const auto &step : plan["tables"].get_array()[0]["operations"]
+                                .get_array()) {
+      if (step["operation"].get_string() == "modify-column" &&
+          step["name"].get_string() == column) {
+        return true;
+      }
+    }
+    return false;
+  };
+  expect(modified("score") && !modified("name") && !modified("seen"),
+         "plan_json lists the changed defaults only");
+}
+
+void column_order_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse("[]");
+  auto live = parse(live_json);
+  replicate_options options;
+  // A column inserted in the middle moves alone
+  auto &columns = tables.get_array()[0]["columns"].get_array();
+  columns.insert(columns.begin() + 1,
+                 parse(R"({"id": "a5", "name": "nick", "type": "int"})"));
+  auto sql = diff_sql("db", tables, users, live, options);
+  expect(contains(sql,
+                  "ADD COLUMN `nick` int not null COMMENT 'a5' AFTER `id`") &&
+             !contains(sql, "MODIFY COLUMN `name`"),
+         "diff_sql moves only the inserted column");
+
+  // Swapped columns: one of them moves
+  std::swap(columns[2], columns[3]);
+  sql = diff_sql("db", tables, users, live, options);
+  expect(contains(sql, "COMMENT 'a2' AFTER `score`") !=
+             contains(sql, "COMMENT 'a4' AFTER `nick`"),
+         "diff_sql moves one of two swapped columns");
+
+  options.ignore_column_order = true;
+  sql = diff_sql("db", tables, users, live, options);
+  expect(contains(sql, "ADD COLUMN `nick` int not null COMMENT 'a5',\n") &&
+             !contains(sql, "AFTER"),
+         "diff_sql appends the new columns ignoring the order");
+}
+
+void plan_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse("[]");
+  auto live = parse(live_json);
+  replicate_options options;
+  auto plan = parse(plan_json("db", tables, users, live, options));
+  auto table = [&](const std::string &name) -> const jsonio::json * {
+    for (const auto &entry : plan["tables"].get_array()) {
+      if (entry["name"].get_string() == name) {
+        return &entry;
+      }
+    }
+    return nullptr;
+  };
+  auto find = [&](const std::string &name, const std::string &operation,
+                  const std::string &object) -> const jsonio::json * {
+    if (auto entry = table(name); entry) {
+      for (const auto &step : (*entry)["operations"].get_array()) {
+        if (step["operation"].get_string() == operation &&
+            step["name"].get_string() == object) {
+          return &step;
+        }
+      }
+    }
+    return nullptr;
+  };
+  expect(find("user", "rename-table", "user") &&
+             (*find("user", "rename-table", "user"))["from"].get_string() ==
+                 "people",
+         "plan_json lists a renamed table");
+  auto modify = find("user", "modify-column", "score");
+  expect(modify && (*modify)["algorithm"].get_string() == "instant" &&
+             !find("user", "modify-column", "name"),
+         "plan_json ranks a changed default as instant");
+  expect((*table("user"))["algorithm"].get_string() == "instant",
+         "plan_json ranks a table by its most expensive operation");
+  expect(find("member", "create-table", "member") &&
+             find("member", "add-foreign-key", "fk_user") &&
+             find("legacy", "drop-table", "legacy"),
+         "plan_json lists the created and dropped tables");
+}
+
+void foreign_key_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse("[]");
+  auto live = parse(live_json);
+  tables.get_array()[1]["algorithm"] = parse(R"("inplace")");
+  live["tables"].get_array().push_back(
+      parse(R"({"name": "member", "type": "BASE TABLE", "engine": "InnoDB",
+          "comment": "B"})"));
+  for (auto column : {R"({"table": "member", "name": "id", "position": "1",
+          "type": "int unsigned", "null": "NO", "extra": "auto_increment",
+          "comment": "b1"})",
+                      R"({"table": "member", "name": "user",
+          "position": "2", "type": "int unsigned", "null": "NO", "extra": "",
+          "comment": "b2"})"}) {
+    live["columns"].get_array().push_back(parse(column));
+  }
+  live["indexes"].get_array().push_back(
+      parse(R"({"table": "member", "name": "PRIMARY", "unique": "YES",
+          "columns": ["id"]})"));
+  live["indexes"].get_array().push_back(
+      parse(R"({"table": "member", "name": "ix_user", "unique": "NO",
+          "columns": ["user"]})"));
+  replicate_options options;
+  auto sql = diff_sql("db", tables, users, live, options);
+
+  // Checked by a query, then added in place under the inplace policy
+  expect(contains(sql, "DO (SELECT 1 UNION ALL (SELECT 1 FROM `db`.`member` "
+                       "AS `child` WHERE `child`.`user` IS NOT NULL AND NOT "
+                       "EXISTS (SELECT 1 FROM `db`.`user` AS `parent` WHERE "
+                       "`parent`.`id` = `child`.`user`) LIMIT 1));") &&
+             contains(sql, "SET foreign_key_checks = 0;\nALTER TABLE "
+                           "`db`.`member`\n    ADD CONSTRAINT `fk_user`"),
+         "diff_sql adds a foreign key in place after checking the rows");
+  expect(contains(sql, "ON DELETE cascade,\n    ALGORITHM=INPLACE, LOCK=NONE;"),
+         "diff_sql adds the foreign keys with the inplace algorithm");
+  auto plan = parse(plan_json("db", tables, users, live, options));
+  auto find = [&]() -> const jsonio::json * {
+    for (const auto &entry : plan["tables"].get_array()) {
+      for (const auto &step : entry["operations"].get_array()) {
+        if (step["operation"].get_string() == "add-foreign-key") {
+          return &step;
+        }
+      }
+    }
+    return nullptr;
+  };
+  expect(find() && (*find())["algorithm"].get_string() == "inplace",
+         "plan_json ranks a foreign key in place under the inplace policy");
+
+  // Without a policy the foreign key is added with its checks
+  tables.get_array()[1].get_object().erase("algorithm");
+  sql = diff_sql("db", tables, users, live, options);
+  expect(!contains(sql, "foreign_key_checks"),
+         "diff_sql keeps the checks without a policy");
+  plan = parse(plan_json("db", tables, users, live, options));
+  expect(find() && (*find())["algorithm"].get_string() == "copy",
+         "plan_json ranks a checked foreign key as a copy");
+}
+
+void algorithm_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse("[]");
+  auto live = parse(live_json);
+  replicate_options options;
+  expect(!contains(diff_sql("db", tables, users, live, options), "ALGORITHM="),
+         "diff_sql leaves the algorithm to the server without a policy");
+
+  // The cheapest algorithm of the operations, capped by the policy
+  options.algorithm = "copy";
+  auto sql = diff_sql("db", tables, users, live, options);
+  expect(contains(sql, "MODIFY COLUMN `score` int DEFAULT 0 not null "
+                       "COMMENT 'a4',\n    ALGORITHM=INSTANT;"),
+         "diff_sql appends the algorithm of an ALTER TABLE");
+  expect(contains(sql, "ON DELETE cascade;\n"),
+         "diff_sql adds no algorithm to the ALTER TABLE of a new table");
+  live["columns"].get_array()[1]["null"] = parse(R"("YES")");
+  options.algorithm = "instant";
+  sql = diff_sql("db", tables, users, live, options);
+  expect(contains(sql, "COMMENT 'a4',\n    ALGORITHM=INSTANT;"),
+         "diff_sql caps the algorithm by the policy");
+  tables.get_array()[0]["algorithm"] = parse(R"("copy")");
+  sql = diff_sql("db", tables, users, live, options);
+  expect(contains(sql, "COMMENT 'a4',\n    ALGORITHM=INPLACE, LOCK=NONE;"),
+         "diff_sql follows the policy of the table");
+
+  options.algorithm = "INPLACE";
+  bool thrown = false;
+  try {
+    diff_sql("db", tables, users, live, options);
+  } catch (const std::runtime_error &) {
+    thrown = true;
+  }
+  expect(thrown, "diff_sql refuses an unknown algorithm");
+}
+
+void view_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse("[]");
+  auto live = parse(live_json);
+  tables.get_array()[0]["views"] = parse(R"json([{"name": "user_names",
+    "columns": ["name"], "joints": [{"type": "left outer", "table": "member",
+      "as": "m", "ons": [{"base": {"table": "user", "column": "id"},
+        "foreign": "user"}],
+      "columns": [{"name": "id", "as": "member"}]}]}])json");
+  replicate_options options;
+  auto sql = diff_sql("db", tables, users, live, options);
+  expect(contains(sql, "CREATE OR REPLACE VIEW `db`.`user_names` AS "),
+         "diff_sql creates a missing view");
+
+  // The definition as the server keeps it
+  auto definition = [](const std::string &table) {
+    return parse("\"select `db`.`" + table +
+                 "`.`name` AS `name`,`m`.`id` AS `member` from (`db`.`" +
+                 table + "` left join `db`.`member` `m` on((`db`.`" + table +
+                 "`.`id` = `m`.`user`)))\"");
+  };
+  live["tables"].get_array().push_back(
+      parse(R"({"name": "user_names", "type": "VIEW", "engine": "",
+          "comment": "VIEW"})"));
+  live["views"] = parse(R"([{"name": "user_names", "definition": ""}])");
+  live["views"].get_array()[0]["definition"] = definition("user");
+  sql = diff_sql("db", tables, users, live, options);
+  expect(!contains(sql, "VIEW `db`.`user_names`"),
+         "diff_sql keeps an unchanged view");
+  options.report = true;
+  expect(contains(diff_sql("db", tables, users, live, options),
+                  "\n-- View \"user_names\" is ok.\n"),
+         "diff_sql reports an unchanged view");
+
+  live["views"].get_array()[0]["definition"] = definition("people");
+  sql = diff_sql("db", tables, users, live, options);
+  expect(contains(sql, "CREATE OR REPLACE VIEW `db`.`user_names` AS "),
+         "diff_sql replaces a changed view");
+  live.get_object().erase("views");
+  sql = diff_sql("db", tables, users, live, options);
+  expect(contains(sql, "CREATE OR REPLACE VIEW `db`.`user_names` AS "),
+         "diff_sql replaces the views of an older snapshot");
+}
+
+void staged_drop_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse("[]");
+  auto live = parse(live_json);
+  live["indexes"].get_array().push_back(
+      parse(R"({"table": "people", "name": "uq_name", "unique": "YES",
+          "visible": "YES", "columns": ["name"]})"));
+  replicate_options options;
+  auto sql = diff_sql("db", tables, users, live, options);
+  expect(contains(sql, "DROP INDEX `uq_name`"),
+         "diff_sql drops an extra key at once by default");
+
+  // Hidden first, dropped once found hidden
+  options.staged_index_drops = true;
+  sql = diff_sql("db", tables, users, live, options);
+  expect(contains(sql, "ALTER INDEX `uq_name` INVISIBLE") &&
+             !contains(sql, "DROP INDEX `uq_name`"),
+         "diff_sql hides an extra key");
+  live["indexes"].get_array().back()["visible"] = parse("\"NO\"");
+  sql = diff_sql("db", tables, users, live, options);
+  expect(contains(sql, "DROP INDEX `uq_name`"),
+         "diff_sql drops a hidden extra key");
+
+  // A key defined again is shown
+  tables.get_array()[0]["keys"].get_array().push_back(
+      parse(R"({"name": "uq_name", "type": "unique", "columns": ["name"]})"));
+  sql = diff_sql("db", tables, users, live, options);
+  expect(contains(sql, "ALTER INDEX `uq_name` VISIBLE"),
+         "diff_sql shows a hidden key defined again");
+}
+
+void partition_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse("[]");
+  auto live = parse(live_json);
+  tables.get_array().push_back(parse(R"json({"id": "C", "name": "event",
+    "columns": [{"id": "c1", "name": "day", "type": "date"}],
+    "partitioning": {"type": "range columns", "expression": "day",
+      "partitions": [{"name": "y2024", "values": "\"2025-01-01\""},
+        {"name": "p2025", "values": "\"2026-01-01\""},
+        {"name": "pmax", "values": "MAXVALUE"}]}})json"));
+  tables.get_array().push_back(parse(R"json({"id": "D", "name": "bucket",
+    "columns": [{"id": "d1", "name": "id", "type": "int"}],
+    "partitioning": {"type": "hash", "expression": "id",
+      "count": 4}})json"));
+  for (auto [name, comment, column] :
+       {std::array<const char *, 3>{"event", "C", "c1"},
+        std::array<const char *, 3>{"bucket", "D", "d1"}}) {
+    live["tables"].get_array().push_back(
+        parse(std::string{R"({"name": ")"} + name +
+              R"(", "type": "BASE TABLE", "engine": "InnoDB", "comment": ")" +
+              comment + "\"}"));
+  }
+  live["columns"].get_array().push_back(
+      parse(R"({"table": "event", "name": "day", "position": "1",
+          "type": "date", "null": "NO", "extra": "", "comment": "c1"})"));
+  live["columns"].get_array().push_back(
+      parse(R"({"table": "bucket", "name": "id", "position": "1",
+          "type": "int", "null": "NO", "extra": "", "comment": "d1"})"));
+  live["partitions"] = parse(R"json([
+    {"table": "event", "name": "p2023", "position": "1",
+      "method": "RANGE COLUMNS", "expression": "`day`",
+      "description": "'2024-01-01'"},
+    {"table": "event", "name": "p2024", "position": "2",
+      "method": "RANGE COLUMNS", "expression": "`day`",
+      "description": "'2025-01-01'"},
+    {"table": "event", "name": "pmax", "position": "3",
+      "method": "RANGE COLUMNS", "expression": "`day`",
+      "description": "MAXVALUE"},
+    {"table": "bucket", "name": "p0", "position": "1", "method": "HASH",
+      "expression": "`id`", "description": ""},
+    {"table": "bucket", "name": "p1", "position": "2", "method": "HASH",
+      "expression": "`id`", "description": ""}])json");
+  replicate_options options;
+  auto sql = diff_sql("db", tables, users, live, options);
+
+  // p2023 is dropped, p2024 renamed to y2024 with its rows, p2025 split off
+  // the MAXVALUE partition
+  expect(contains(sql, "ALTER TABLE `db`.`event` DROP PARTITION `p2023`;"),
+         "diff_sql drops a partition missing from the definition");
+  expect(contains(sql,
+                  "ALTER TABLE `db`.`event` REORGANIZE PARTITION `p2024`, "
+                  "`pmax` INTO (PARTITION `y2024` VALUES LESS THAN "
+                  "(\"2025-01-01\"), PARTITION `p2025` VALUES LESS THAN "
+                  "(\"2026-01-01\"), PARTITION `pmax` VALUES LESS THAN "
+                  "(MAXVALUE));"),
+         "diff_sql reorganizes a renamed partition");
+  expect(!contains(sql, "DROP PARTITION `p2024`"),
+         "diff_sql keeps the rows of a renamed partition");
+  expect(contains(sql,
+                  "ALTER TABLE `db`.`bucket` ADD PARTITION PARTITIONS 2;"),
+         "diff_sql adds hash partitions");
+
+  auto plan = parse(plan_json("db", tables, users, live, options));
+  auto find = [&](const std::string &operation, const std::string &name) {
+    for (const auto &entry : plan["tables"].get_array()) {
+      for (const auto &step : entry["operations"].get_array()) {
+        if (step["operation"].get_string() == operation &&
+            step["name"].get_string() == name) {
+          return true;
+        }
+      }
+    }
+    return false;
+  };
+  expect(find("drop-partition", "p2023") &&
+             find("reorganize-partition", "p2024") &&
+             !find("drop-partition", "p2024"),
+         "plan_json lists the partition changes");
+}
+
+} // namespace
+
+int main() {
+  diff_tests();
+  default_tests();
+  column_order_tests();
+  plan_tests();
+  foreign_key_tests();
+  algorithm_tests();
+  view_tests();
+  staged_drop_tests();
+  partition_tests();
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,482 @@
+#include <cstdio>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "sqlr.h"
+
+// Checks of the scripts of replicate_sql() and of the templates writing them
+// for several databases.
+
+namespace {
+
+int failures = 0;
+
+void expect(bool condition, const char *what) {
+  if (!condition) {
+    std::fprintf(stderr, "failed: %s\n", what);
+    ++failures;
+  }
+}
+
+jsonio::json parse(const std::string &text) {
+  jsonio::json value;
+  std::istringstream{text} >> value;
+  return value;
+}
+
+bool contains(const std::string &text, const std::string &part) {
+  return text.find(part) != std::string::npos;
+}
+
+std::size_t occurrences(const std::string &text, const std::string &part) {
+  std::size_t count = 0;
+  for (auto at = text.find(part); at != std::string::npos;
+       at = text.find(part, at + part.size())) {
+    ++count;
+  }
+  return count;
+}
+
+// Keeps every chunk written to the stream
+struct chunk_buffer : std::streambuf {
+  std::vector<std::string> chunks;
+
+  std::streamsize xsputn(const char *text, std::streamsize size) override {
+    chunks.emplace_back(text, size);
+    return size;
+  }
+
+  int_type overflow(int_type c) override {
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      chunks.emplace_back(1, traits_type::to_char_type(c));
+    }
+    return c;
+  }
+};
+
+const char tables_json[] = R"json([
+  {"id": "A", "name": "user", "columns": [
+      {"id": "a1", "name": "id", "type": "int unsigned", "auto": true},
+      {"id": "a2", "name": "name", "type": "varchar(64)", "null": true}],
+    "keys": [{"name": "PRIMARY", "type": "primary key", "columns": ["id"]},
+      {"name": "ix_name", "type": "index", "columns": ["name"]}],
+    "views": [{"name": "user_names", "columns": ["id", "name"],
+      "joints": []}],
+    "rows": [{"id": "1", "name": "'Ann'"}, {"id": "2", "name": "'Bob'"}]},
+  {"id": "B", "name": "member", "columns": [
+      {"id": "b1", "name": "id", "type": "int unsigned", "auto": true},
+      {"id": "b2", "name": "user", "type": "int unsigned"}],
+    "keys": [{"name": "PRIMARY", "type": "primary key", "columns": ["id"]},
+      {"name": "ix_user", "type": "index", "columns": ["user"]}],
+    "foreign-keys": [{"name": "fk_user", "table": "user",
+      "columns": ["user"], "keys": ["id"], "update": "cascade",
+      "delete": "cascade"}]}
+])json";
+
+const char users_json[] = R"json([{"name": "Alice", "permissions": [
+  {"subject": "user", "operations": ["SELECT"]}]}])json";
+
+// Tables of two columns and a primary key
+jsonio::json many_tables(int count) {
+  std::string many = "[";
+  for (int i = 0; i < count; ++i) {
+    auto n = std::to_string(i);
+    many += std::string{i ? ", " : ""} + R"({"id": "T)" + n +
+            R"(", "name": "t)" + n + R"(", "columns": [
+        {"id": "c1", "name": "id", "type": "int"},
+        {"id": "c2", "name": "v", "type": "int", "default": ")" +
+            n + R"("}],
+      "keys": [{"name": "PRIMARY", "type": "primary key",
+        "columns": ["id"]}]})";
+  }
+  return parse(many + "]");
+}
+
+void snapshot_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse(users_json);
+  replicate_options options;
+  auto script = replicate_sql("db", tables, users, options);
+  expect(script == replicate_sql("db", tables, users, false, false),
+         "the bool options write the same script");
+  expect(!contains(script, "`_sql_columns`"),
+         "lookups read INFORMATION_SCHEMA without a snapshot");
+
+  options.snapshot = true;
+  script = replicate_sql("db", tables, users, options);
+  expect(contains(script, "create temporary table `db`.`_sql_columns`") &&
+             contains(script, "insert into `db`.`_sql_columns`"),
+         "snapshot mode copies the columns once");
+  expect(contains(script, "from `db`.`_sql_columns` as `COLUMNS`"),
+         "snapshot mode reads the columns from the copy");
+  auto marked = script.find("No extra table.");
+  auto reloaded = script.find("insert into `db`.`_sql_columns`", marked);
+  expect(marked != std::string::npos && reloaded != std::string::npos &&
+             reloaded < script.find("set @ren_tables_prefix", marked),
+         "snapshot mode reloads the columns of the created tables");
+
+  // The copies would need the database, which a dry run doesn't create
+  options.dry_run = true;
+  script = replicate_sql("db", tables, users, options);
+  expect(!contains(script, "`_sql_columns`") &&
+             contains(script, "from `INFORMATION_SCHEMA`.`COLUMNS`"),
+         "a dry run reads INFORMATION_SCHEMA in snapshot mode");
+}
+
+void alter_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse(users_json);
+  replicate_options options;
+  auto script = replicate_sql("db", tables, users, options);
+  // Every change of a table in one statement, the foreign keys once the
+  // referenced tables exist
+  expect(occurrences(script, "'ALTER TABLE `db`.`', 'user'") == 1,
+         "the changes of a table are coalesced");
+  expect(occurrences(script, "'ALTER TABLE `db`.`', 'member'") == 2,
+         "the foreign keys are added after the other changes");
+}
+
+void algorithm_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse(users_json);
+  replicate_options options;
+  expect(!contains(replicate_sql("db", tables, users, options), "ALGORITHM="),
+         "the server picks the algorithm without a policy");
+
+  options.algorithm = "inplace";
+  auto script = replicate_sql("db", tables, users, options);
+  expect(occurrences(script, "elt(least(@alter_cost, 1) + 1,") == 3,
+         "the policy caps the algorithm of every ALTER TABLE");
+  // A foreign key is added in place once no row lacks its parent
+  expect(contains(script, "NOT EXISTS (SELECT 1 FROM `db`.`user` AS `parent` "
+                          "WHERE `parent`.`id` = `child`.`user`)") &&
+             contains(script, "set foreign_key_checks = if (@alter_cost < 2"),
+         "foreign keys are added in place under the inplace policy");
+  tables.get_array()[1]["algorithm"] = parse("\"copy\"");
+  script = replicate_sql("db", tables, users, options);
+  expect(occurrences(script, "elt(least(@alter_cost, 2) + 1,") == 2,
+         "a table overrides the policy");
+
+  for (const auto &algorithm : {"fast", "INPLACE"}) {
+    options.algorithm = algorithm;
+    bool thrown = false;
+    try {
+      replicate_sql("db", tables, users, options);
+    } catch (const std::runtime_error &) {
+      thrown = true;
+    }
+    expect(thrown, "replicate_sql refuses an unknown algorithm");
+  }
+}
+
+void stream_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse(users_json);
+  replicate_options options;
+  chunk_buffer buffer;
+  std::ostream out{&buffer};
+  replicate_sql(out, "db", tables, users, options);
+  std::string written;
+  for (const auto &chunk : buffer.chunks) {
+    written += chunk;
+  }
+  expect(written == replicate_sql("db", tables, users, options),
+         "replicate_sql streams the script it returns");
+  expect(buffer.chunks.size() > 10,
+         "replicate_sql writes the script statement by statement");
+
+  std::ostringstream compiled;
+  replicate_sql(compiled, "db", compile_schema(tables), users, options);
+  expect(compiled.str() == written,
+         "replicate_sql writes the same script from the compiled tables");
+}
+
+void thread_tests() {
+  // More tables than threads, so each thread fills several fragments
+  auto tables = many_tables(20);
+  auto users = parse(users_json);
+  replicate_options options;
+  options.report = true;
+  auto serial = replicate_sql("db", tables, users, options);
+  for (std::size_t threads : {2, 3, 8}) {
+    options.threads = threads;
+    expect(replicate_sql("db", tables, users, options) == serial,
+           "the threads write the script of one thread");
+  }
+}
+
+void fingerprint_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse(users_json);
+  replicate_options options;
+  expect(!contains(replicate_sql("db", tables, users, options),
+                   "_sql_fingerprints"),
+         "no fingerprint is kept by default");
+  options.fingerprints = true;
+  auto script = replicate_sql("db", tables, users, options);
+  auto model = compile_schema(tables);
+  expect(contains(script, "set @table_unchanged = instr(@fingerprints, '{A:" +
+                              model.tables[0].fingerprint + "}') > 0;"),
+         "the checks of a table follow its fingerprint");
+  expect(contains(script, "`db`.`_sql_fingerprints`"),
+         "the fingerprints are kept in the database");
+}
+
+void procedure_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse(users_json);
+  replicate_options options;
+  auto inline_script = replicate_sql("db", tables, users, options);
+  options.procedures = true;
+  auto script = replicate_sql("db", tables, users, options);
+  expect(contains(script, "CREATE PROCEDURE `db`.`_sql_column`(") &&
+             contains(script, "DROP PROCEDURE IF EXISTS `db`.`_sql_column`"),
+         "the procedures are installed and dropped");
+  expect(occurrences(script, "call `db`.`_sql_column`(") == 4 &&
+             occurrences(script, "call `db`.`_sql_key`(") == 4 &&
+             occurrences(script, "call `db`.`_sql_foreign_key`(") == 1,
+         "every column, key and foreign key is checked by a call");
+  expect(occurrences(script, "call `db`.`_sql_table`(") == 2 &&
+             occurrences(script, "call `db`.`_sql_extra_keys`(") == 2 &&
+             occurrences(script, "call `db`.`_sql_constraint`(") == 1 &&
+             occurrences(script, "call `db`.`_sql_alter`(") == 3,
+         "the lookups and the ALTER TABLE of every table are calls");
+
+  auto many = many_tables(20);
+  options.procedures = false;
+  inline_script = replicate_sql("db", many, users, options);
+  options.procedures = true;
+  expect(replicate_sql("db", many, users, options).size() * 4 <
+             inline_script.size(),
+         "the procedures shorten the script");
+
+  // A dry run may target a database that doesn't exist yet
+  options.dry_run = true;
+  script = replicate_sql("db", tables, users, options);
+  options.procedures = false;
+  expect(!contains(script, "CREATE PROCEDURE") &&
+             script == replicate_sql("db", tables, users, options),
+         "a dry run installs no procedure");
+}
+
+void table_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse(users_json);
+  replicate_options options;
+  auto script = replicate_sql("db", tables, users, options);
+  expect(contains(script, "'user` (\n"
+                          "    `id` int unsigned not null auto_increment "
+                          "COMMENT \\'a1\\',\n"
+                          "    `name` varchar(64) null COMMENT \\'a2\\',\n"
+                          "    primary key `PRIMARY` (`id`),\n"
+                          "    index `ix_name` (`name`)\n"
+                          ") ENGINE=InnoDB"),
+         "a new table is created with its columns and keys");
+  expect(contains(script, "set @ren_tables = if (@ren_collision,\n"
+                          "    concat(@ren_tables_prefix, "
+                          "@ren_tables_final), @ren_tables_direct);"),
+         "the tables are renamed by one statement");
+}
+
+void shadow_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse(users_json);
+  replicate_options options;
+  options.shadow_bytes = 1 << 20;
+  options.shadow_chunk_rows = 500;
+  auto script = replicate_sql("db", tables, users, options);
+  expect(contains(script, "CREATE PROCEDURE `db`.`_sql_shadow`(") &&
+             contains(script, "call `db`.`_sql_shadow`('member', 'B', 500);"),
+         "a large table is rebuilt through a shadow copy");
+  expect(contains(script, "'Publish MySQL: Rows Changed During Shadow Copy'") &&
+             contains(script,
+                      "'Publish MySQL: Rows Changed During Shadow Swap'"),
+         "the shadow copy is checked before and after the swap");
+  expect(contains(script, "'` TO `db`.`_sql__stale_', p_table") &&
+             contains(script, "`TABLE_NAME` not like '_sql__stale_%'"),
+         "the table swapped out is kept out of the extra tables");
+  // The copy has none of the foreign keys of the table
+  expect(contains(script, "set @alter_cost = if (instr(@shadow_tables, "
+                          "'{member}') > 0, 1, 2);") &&
+             contains(script, "AS `child` WHERE `child`.`user` IS NOT NULL") &&
+             contains(script, "set foreign_key_checks = if (@alter_cost < 2"),
+         "the foreign keys of a shadow copy are added in place");
+
+  options.dry_run = true;
+  expect(!contains(replicate_sql("db", tables, users, options), "_sql_shadow"),
+         "a dry run copies no table");
+
+  options.dry_run = false;
+  options.shadow_chunk_rows = 0;
+  bool thrown = false;
+  try {
+    replicate_sql("db", tables, users, options);
+  } catch (const std::runtime_error &) {
+    thrown = true;
+  }
+  expect(thrown, "replicate_sql refuses empty chunks");
+}
+
+void stats_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse(users_json);
+  replicate_stats stats;
+  replicate_options options;
+  options.stats = &stats;
+  auto script = replicate_sql("db", tables, users, options);
+  std::size_t bytes = 0;
+  for (const auto &phase : stats.phases) {
+    bytes += phase.bytes;
+  }
+  expect(stats.bytes == script.size() && !stats.phases.empty() &&
+             bytes <= stats.bytes,
+         "the stats count the bytes of every phase");
+  replicate_sql("db", tables, users, options);
+  expect(stats.bytes == script.size(), "the stats are reset by every run");
+
+  options.report = true;
+  script = replicate_sql("db", tables, users, options);
+  expect(contains(script, "now(6)"), "report mode times the phases");
+}
+
+void template_tests() {
+  auto tables = compile_schema(parse(tables_json));
+  auto users = parse(users_json);
+  std::vector<replicate_options> variants(8);
+  variants[1].report = true;
+  variants[2].dry_run = true;
+  variants[2].report = true;
+  variants[3].snapshot = true;
+  variants[3].threads = 4;
+  variants[4].fingerprints = true;
+  variants[4].procedures = true;
+  variants[5].shadow_bytes = 1;
+  variants[5].algorithm = "copy";
+  variants[6].reconcile_rows = true;
+  variants[6].delete_stale_rows = true;
+  variants[6].staged_index_drops = true;
+  variants[7].ignore_column_order = true;
+  variants[7].foreign_key_indexes = "warn";
+  variants[7].redundant_keys = "warn";
+  for (const auto &options : variants) {
+    auto script = replicate_template(tables, users, options);
+    for (const auto &db_name : {"db", "other_db", "x"}) {
+      std::ostringstream direct, written;
+      replicate_sql(direct, db_name, tables, users, options);
+      write_sql(written, script, db_name);
+      expect(direct.str() == written.str(),
+             "write_sql writes the script of replicate_sql");
+    }
+  }
+
+  // Several databases from one generation, one after another
+  replicate_options options;
+  std::ostringstream both, first, second;
+  replicate_sql(both, std::vector<std::string>{"a", "b"}, tables, users,
+                options);
+  replicate_sql(first, "a", tables, users, options);
+  replicate_sql(second, "b", tables, users, options);
+  expect(both.str() == first.str() + second.str(),
+         "replicate_sql writes every database in turn");
+
+  std::ostringstream partial;
+  bool thrown = false;
+  try {
+    replicate_sql(partial, std::vector<std::string>{"a", "b'c"}, tables,
+                  users, options);
+  } catch (const std::runtime_error &) {
+    thrown = true;
+  }
+  expect(thrown && partial.str().empty(),
+         "replicate_sql writes nothing with a bad database name");
+  for (const auto &bad : {"a'b", "a`b", "a\x01"}) {
+    thrown = false;
+    try {
+      check_database_name(bad);
+    } catch (const std::runtime_error &) {
+      thrown = true;
+    }
+    expect(thrown, "check_database_name rejects a bad name");
+  }
+}
+
+void view_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse(users_json);
+  replicate_options options;
+  auto script = replicate_sql("db", tables, users, options);
+  // The new SELECT is compared through a probe view before the replacement
+  auto probe = script.find(
+      "concat('CREATE OR REPLACE VIEW `db`.`_sql_probe` AS ', @view_select");
+  auto replace = script.find("set @qry = if (@old_view = @new_view,", probe);
+  expect(probe != std::string::npos && replace != std::string::npos &&
+             contains(script, "concat('CREATE OR REPLACE VIEW "
+                              "`db`.`user_names` AS ', @view_select"),
+         "a view is replaced only when it changed");
+
+  options.dry_run = true;
+  expect(!contains(replicate_sql("db", tables, users, options), "_sql_probe"),
+         "a dry run doesn't create the probe view");
+}
+
+void foreign_key_index_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse(users_json);
+  tables.get_array()[1]["keys"].get_array().pop_back();
+  replicate_options options;
+  options.foreign_key_indexes = "warn";
+  auto script = replicate_sql("db", tables, users, options);
+  expect(script.rfind("\n-- Publish MySQL: Unindexed Foreign Key at "
+                      "[1].foreign-keys[0]\n",
+                      0) == 0,
+         "the unindexed foreign keys are listed first");
+  options.foreign_key_indexes = "add";
+  script = replicate_sql("db", tables, users, options);
+  expect(contains(script, "    index `fk_user` (`user`)\n"),
+         "the unindexed foreign keys are indexed");
+}
+
+void redundant_key_tests() {
+  auto tables = parse(tables_json);
+  auto users = parse(users_json);
+  tables.get_array()[0]["keys"].get_array().push_back(
+      parse(R"({"name": "ix_name2", "type": "index", "columns": ["name"]})"));
+  replicate_options options;
+  options.redundant_keys = "warn";
+  expect(replicate_sql("db", tables, users, options)
+                 .rfind("\n-- Publish MySQL: Duplicate Key at [0].keys[2] by "
+                        "[0].keys[1]",
+                        0) == 0,
+         "the redundant keys are listed first");
+  options.redundant_keys = "strict";
+  bool thrown = false;
+  try {
+    replicate_sql("db", tables, users, options);
+  } catch (const std::runtime_error &) {
+    thrown = true;
+  }
+  expect(thrown, "replicate_sql refuses redundant keys when strict");
+}
+
+} // namespace
+
+int main() {
+  snapshot_tests();
+  alter_tests();
+  algorithm_tests();
+  stream_tests();
+  thread_tests();
+  fingerprint_tests();
+  procedure_tests();
+  table_tests();
+  shadow_tests();
+  stats_tests();
+  template_tests();
+  view_tests();
+  foreign_key_index_tests();
+  redundant_key_tests();
+  return failures == 0 ? 0 : 1;
+}
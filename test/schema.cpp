@@ -0,0 +1,231 @@
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "schema.h"
+
+// Checks of the validation of the definitions and of the key lints.
+
+namespace {
+
+int failures = 0;
+
+void expect(bool condition, const char *what) {
+  if (!condition) {
+    std::fprintf(stderr, "failed: %s\n", what);
+    ++failures;
+  }
+}
+
+jsonio::json parse(const std::string &text) {
+  jsonio::json value;
+  std::istringstream{text} >> value;
+  return value;
+}
+
+// Error message of compile_schema(), empty when the definition is valid.
+std::string errors(const std::string &tables) {
+  try {
+    compile_schema(parse(tables));
+  } catch (const std::runtime_error &error) {
+    return error.what();
+  }
+  return "";
+}
+
+void compile_schema_tests() {
+  auto valid = R"([{"id": "A", "name": "t", "columns": [
+      {"id": "c1", "name": "id", "type": "int", "default": "\"x\""}],
+    "keys": [{"name": "PRIMARY", "type": "primary key",
+      "columns": ["id"]}]}])";
+  expect(errors(valid).empty(), "compile_schema accepts a valid table");
+  auto model = compile_schema(parse(valid));
+  expect(model.tables.size() == 1 &&
+             model.tables[0].primary == std::vector<std::string>{"id"} &&
+             model.tables[0].columns[0].definition ==
+                 "`id` int DEFAULT \"x\" not null",
+         "compile_schema resolves the columns and the primary key");
+  expect(model.tables[0].engine == "InnoDB" &&
+             model.tables[0].keys[0].quoted_columns == "`id`" &&
+             model.tables[0].keys[0].column_ids == "c1",
+         "compile_schema fills the defaults and the key columns");
+
+  // Every error is collected with its path, one per line
+  expect(errors(R"([{"id": "A", "name": "_sql_t", "columns": [
+      {"id": "c1", "name": "a", "type": "int"},
+      {"id": "c1", "name": "b", "type": "int"}],
+    "keys": [{"name": "k", "type": "primary key", "columns": ["a"]}]},
+    {"id": "A", "name": "u", "algorithm": "fast", "columns": []}])") ==
+             "Publish MySQL: Table Bad Prefix at [0].name\n"
+             "Publish MySQL: Repeated Column Id at [0].columns[1].id\n"
+             "Publish MySQL: Invalid Primary Key Name at [0].keys[0].name\n"
+             "Publish MySQL: Repeated Table Id at [1].id\n"
+             "Publish MySQL: Bad Algorithm at [1].algorithm",
+         "compile_schema lists every error");
+  expect(errors(R"([{"id": "A", "name": "t", "columns": [
+      {"id": "c1", "name": "a", "type": "int", "default": "'x'"}]}])") ==
+             "Publish MySQL: Bad Character at [0].columns[0].default",
+         "compile_schema rejects a quote");
+  expect(errors(R"([{"id": "A", "name": "t", "columns": [], "views": [
+      {"name": "v", "columns": [], "joints": [
+        {"type": "inner", "table": "w", "as": "w", "ons": [],
+          "columns": []}]},
+      {"name": "w", "columns": [], "joints": [
+        {"type": "inner", "table": "v", "as": "v", "ons": [],
+          "columns": []}]}]}])") ==
+             "Publish MySQL: Circular View at [0].views[0]",
+         "compile_schema rejects circular views");
+
+  // A view comes after the views it joins
+  model = compile_schema(parse(R"([{"id": "A", "name": "t", "columns": [],
+    "views": [
+      {"name": "v", "columns": [], "joints": [
+        {"type": "inner", "table": "w", "as": "w", "ons": [],
+          "columns": []}]},
+      {"name": "w", "columns": [], "joints": []}]}])"));
+  expect(model.view_order ==
+             std::vector<std::pair<std::size_t, std::size_t>>{{0, 1}, {0, 0}},
+         "compile_schema orders the views by their joints");
+}
+
+void partitioning_tests() {
+  auto table = [](const std::string &partitioning) {
+    return R"([{"id": "A", "name": "t", "columns": [
+        {"id": "c1", "name": "id", "type": "int"}],
+      "partitioning": )" +
+           partitioning + "}]";
+  };
+  auto model = compile_schema(
+      parse(table(R"({"type": "hash", "expression": "id", "count": 4})")));
+  expect(model.tables[0].partitioning->count == 4 &&
+             model.tables[0].partitioning->definition ==
+                 "PARTITION BY HASH (id) PARTITIONS 4",
+         "compile_schema reads the partition count as a number");
+  model = compile_schema(parse(table(R"({"type": "range",
+      "expression": "id", "partitions": [
+        {"name": "p0", "values": "10"},
+        {"name": "pmax", "values": "maxvalue"}]})")));
+  expect(model.tables[0].partitioning->definition ==
+             "PARTITION BY RANGE (id) (PARTITION `p0` VALUES LESS THAN (10), "
+             "PARTITION `pmax` VALUES LESS THAN MAXVALUE)",
+         "compile_schema defines range partitions");
+
+  expect(errors(table(R"({"type": "hash", "expression": "id",
+      "count": 0})")) ==
+             "Publish MySQL: Bad Partition Count at [0].partitioning.count",
+         "compile_schema rejects no hash partition");
+  expect(errors(table(R"({"type": "range", "expression": "id",
+      "count": 2, "partitions": [
+        {"name": "p", "values": "1"}, {"name": "p", "values": "2"}]})")) ==
+             "Publish MySQL: Repeated Partition Name at "
+             "[0].partitioning.partitions[1].name\n"
+             "Publish MySQL: Count Without Hash at [0].partitioning.count",
+         "compile_schema rejects a bad range partitioning");
+  expect(errors(table(R"({"type": "sorted"})")) ==
+             "Publish MySQL: Bad Partitioning Type at [0].partitioning.type",
+         "compile_schema rejects an unknown method");
+
+  // Foreign keys can neither start nor end at a partitioned table
+  auto referenced = R"([{"id": "A", "name": "t", "columns": [
+      {"id": "c1", "name": "id", "type": "int"}],
+    "keys": [{"name": "PRIMARY", "type": "primary key", "columns": ["id"]}],
+    "partitioning": {"type": "key", "count": 2}},
+    {"id": "B", "name": "u", "columns": [
+      {"id": "c1", "name": "t", "type": "int"}],
+    "foreign-keys": [{"name": "fk", "table": "t", "columns": ["t"],
+      "keys": ["id"], "update": "cascade", "delete": "cascade"}]}])";
+  expect(errors(referenced) == "Publish MySQL: Foreign Key To Partitioned "
+                               "Table at [1].foreign-keys[0].table",
+         "compile_schema rejects a foreign key to a partitioned table");
+}
+
+void fingerprint_tests() {
+  auto table = [](const std::string &type, const std::string &rows) {
+    auto model = compile_schema(parse(
+        R"([{"id": "A", "name": "t", "columns": [{"id": "c1", "name": "id",
+            "type": ")" +
+        type + R"("}], "rows": )" + rows + "}]"));
+    return model.tables[0].fingerprint;
+  };
+  auto fingerprint = table("int", "[]");
+  expect(fingerprint.size() == 16 &&
+             fingerprint.find_first_not_of("0123456789abcdef") ==
+                 std::string::npos,
+         "the fingerprint is a 64 bit hex hash");
+  expect(table("int", "[]") == fingerprint,
+         "the fingerprint is stable across compilations");
+  expect(table("bigint", "[]") != fingerprint,
+         "the fingerprint follows the columns");
+  expect(table("int", R"([{"id": "1"}])") == fingerprint,
+         "the fingerprint leaves the seed rows out");
+}
+
+void redundant_key_tests() {
+  auto model = compile_schema(parse(R"json([{"id": "A", "name": "t",
+    "columns": [
+      {"id": "c1", "name": "id", "type": "int unsigned"},
+      {"id": "c2", "name": "a", "type": "varchar(20)"},
+      {"id": "c3", "name": "b", "type": "int"}],
+    "keys": [
+      {"name": "PRIMARY", "type": "primary key", "columns": ["id"]},
+      {"name": "ix_a", "type": "index", "columns": ["a"]},
+      {"name": "ix_ab", "type": "index", "columns": ["a", "b"]},
+      {"name": "ix_ab2", "type": "index", "columns": ["a", "b"]},
+      {"name": "uq_b", "type": "unique", "columns": ["b"]},
+      {"name": "uq_ba", "type": "unique", "columns": ["b", "a"]}]}])json"));
+  auto found = redundant_keys(model);
+  expect(found ==
+             std::vector<std::string>{
+                 "Publish MySQL: Prefix Covered Key at [0].keys[1] by "
+                 "[0].keys[2], up to 66 bytes per row",
+                 "Publish MySQL: Duplicate Key at [0].keys[3] by [0].keys[2], "
+                 "up to 70 bytes per row",
+                 "Publish MySQL: Redundant Unique Key at [0].keys[5] by "
+                 "[0].keys[4], up to 70 bytes per row"},
+         "redundant_keys finds the duplicate and covered keys");
+}
+
+void foreign_key_index_tests() {
+  auto model = compile_schema(parse(R"([{"id": "A", "name": "p", "columns": [
+      {"id": "c1", "name": "id", "type": "int"}],
+    "keys": [{"name": "PRIMARY", "type": "primary key", "columns": ["id"]}]},
+    {"id": "B", "name": "c", "columns": [
+      {"id": "c1", "name": "id", "type": "int"},
+      {"id": "c2", "name": "p", "type": "int"},
+      {"id": "c3", "name": "q", "type": "int"}],
+    "keys": [{"name": "PRIMARY", "type": "primary key", "columns": ["id"]},
+      {"name": "ix_q", "type": "index", "columns": ["q", "p"]}],
+    "foreign-keys": [
+      {"name": "fk_p", "table": "p", "columns": ["p"], "keys": ["id"],
+        "update": "cascade", "delete": "cascade"},
+      {"name": "fk_q", "table": "p", "columns": ["q"], "keys": ["id"],
+        "update": "cascade", "delete": "cascade"}]}])"));
+  expect(unindexed_foreign_keys(model) ==
+             std::vector<std::string>{
+                 "Publish MySQL: Unindexed Foreign Key at [1].foreign-keys[0]"},
+         "unindexed_foreign_keys finds the foreign key without a key");
+  auto fingerprint = model.tables[1].fingerprint;
+  index_foreign_keys(model);
+  expect(model.tables[1].keys.size() == 3 &&
+             model.tables[1].keys[2].name == "fk_p" &&
+             model.tables[1].keys[2].columns ==
+                 std::vector<std::string>{"p"},
+         "index_foreign_keys adds the missing key");
+  expect(unindexed_foreign_keys(model).empty() &&
+             model.tables[1].fingerprint != fingerprint,
+         "index_foreign_keys indexes every foreign key");
+}
+
+} // namespace
+
+int main() {
+  compile_schema_tests();
+  partitioning_tests();
+  fingerprint_tests();
+  foreign_key_index_tests();
+  redundant_key_tests();
+  return failures == 0 ? 0 : 1;
+}